@@ -0,0 +1,79 @@
+#include <string.h>
+
+#include "wiimoteglue.h"
+
+/* Balance board processing: taring, and a steady
+ * total weight.
+ *
+ * The last few readings of each corner sensor are kept
+ * in a ring buffer with running totals, so averaging them
+ * costs the same however long the window is. The averages
+ * give a weight that doesn't jump around as the person on
+ * the board shifts about, and a clean reading to tare with.
+ *
+ * The tare is a per-board offset for each sensor,
+ * remembered in the device registry.
+ */
+
+/*Which xwiimote balance board value is each corner.*/
+static const int corner_index[4] = {
+  2, /*WG_BAL_FL*/
+  0, /*WG_BAL_FR*/
+  3, /*WG_BAL_BL*/
+  1, /*WG_BAL_BR*/
+};
+
+/*Forget past readings, but not the tare.*/
+void balance_reset(struct balance_filter *board) {
+  memset(board->history,0,sizeof(board->history));
+  memset(board->sum,0,sizeof(board->sum));
+  board->pos = 0;
+  board->count = 0;
+}
+
+/*Fills in the tared corner values, in WG_BAL_* order.
+ *Returns the averaged total weight, also tared.
+ */
+int balance_update(struct balance_filter *board, struct xwii_event_abs ev[], int corners[4]) {
+  int *slot = board->history[board->pos];
+  int total = 0;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    int raw = ev[corner_index[i]].x;
+    board->sum[i] += raw - slot[i];
+    slot[i] = raw;
+    corners[i] = raw - board->tare[i];
+    total += board->sum[i] - board->tare[i] * BALANCE_WINDOW;
+  }
+
+  board->pos = (board->pos + 1) & (BALANCE_WINDOW - 1);
+  if (board->count < BALANCE_WINDOW)
+    board->count++;
+
+  /*Until the window fills, the empty entries count as
+   *zero, so only average over what has been seen.
+   */
+  if (board->count < BALANCE_WINDOW) {
+    total = 0;
+    for (i = 0; i < 4; i++)
+      total += board->sum[i] - board->tare[i] * board->count;
+  }
+  return total / board->count;
+}
+
+/*Take the current averaged readings as zero.*/
+int balance_tare(struct balance_filter *board) {
+  int i;
+  if (board->count == 0)
+    return -1;
+  for (i = 0; i < 4; i++)
+    board->tare[i] = board->sum[i] / board->count;
+  board->has_tare = 1;
+  return 0;
+}
+
+void balance_clear_tare(struct balance_filter *board) {
+  memset(board->tare,0,sizeof(board->tare));
+  board->has_tare = 0;
+}
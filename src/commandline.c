@@ -1,10 +1,13 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "wiimoteglue.h"
 
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <math.h>
 
 /* Handles user input from STDIN and command files. */
 
@@ -78,19 +81,23 @@ char * getwholeline(int file) {
   return buffer;
 }
 
-#define NUM_WORDS 6
+#define NUM_WORDS 16
 void process_command(struct wiimoteglue_state *state, char *args[]);
-void update_mapping(struct wiimoteglue_state *state, struct mode_mappings* maps, char *mode, char *in, char *out, char *opt);
+void update_mapping(struct wiimoteglue_state *state, struct mode_mappings* maps, char *mode, char *in, char *out, char *opts[]);
 void toggle_setting(struct wiimoteglue_state *state, struct mode_mappings* maps, int active, char *mode, char *setting, char *opt);
+void update_curve(struct wiimoteglue_state *state, struct mode_mappings* maps, char *mode, char *in, char *opts[]);
 int slot_command(struct wiimoteglue_state *state, char *slotname, char *setting, char *value);
+int mouse_command(struct wiimoteglue_state *state, char *axis, char *speed, char *exponent, char *deadzone);
 int list_objects(struct wiimoteglue_state *state, char *type, char *option);
 int list_devices(struct wii_device_list *devlist, char *option);
 int list_slots(struct wiimoteglue_state *state, char *option);
 int list_mappings(struct wiimoteglue_state *state, char *option);
+int list_timers(struct wiimoteglue_state *state);
+int list_latency(struct wiimoteglue_state *state, char *option);
 
 struct wii_device* lookup_device(struct wii_device_list *devlist, char *name);
-int * get_input_key(char *key_name, int button_map[]);
-int * get_input_axis(char *axis_name, struct event_map *map);
+int16_t * get_input_key(char *key_name, int16_t button_map[]);
+int16_t * get_input_axis(char *axis_name, struct event_map *map);
 int get_output_key(char *key_name);
 int get_output_axis(char *key_name);
 
@@ -98,9 +105,11 @@ int wiimoteglue_handle_input(struct wiimoteglue_state *state, int file) {
   char *line = getwholeline(file);
   if (line != NULL) {
     char *lineptr = line;
-    char *args[NUM_WORDS];
+    char *args[NUM_WORDS+1];
     char **argptr;
 
+    memset(args,0,sizeof(args));
+
     for (argptr = args; (*argptr = strsep(&lineptr, " \t\n")) != NULL;) {
       if (**argptr != '\0') {
 	if (++argptr >= &args[NUM_WORDS]) {
@@ -149,13 +158,18 @@ void process_command(struct wiimoteglue_state *state, char *args[]) {
     printf("\thelp - show this message\n");
     printf("\tmap - change a button/axis mapping\n");
     printf("\tenable/disable - control extra controller features\n");
+    printf("\tcurve - set an input axis's deadzone and response curve\n");
+    printf("\tlayer - add a layer of mappings used while a button is held\n");
     printf("\tlist [type] - list various WiimoteGlue structures\n");
     printf("\tassign - assign a device to a virtual slot\n");
     printf("\tslot - slot specific commands\n");
     printf("\tdevice - device specific commands\n");
-    printf("\tmapping - mapping specific commands\n");
+    printf("\tmouse - relative mouse speed settings\n");
+    printf("\tmacro - define a sequence of key presses to map to a button\n");
+    printf("\tmapping - copy a mapping, or set one for it to inherit from\n");
     printf("\tnew mapping <name> - create a new named mapping\n");
     printf("\tload - opens a file and runs the commands inside\n");
+    printf("\t       (loaded files are reloaded automatically when they change)\n");
     printf("\tquit - close down WiimoteGlue\n");
     printf("\tmodes - show recognized keywords for controller modes\n");
     printf("\tevents - show recognized keywords for input/output events\n");
@@ -166,31 +180,41 @@ void process_command(struct wiimoteglue_state *state, char *args[]) {
   if (strcmp(args[0],"modes") == 0) {
     printf("A separate input mapping is maintained for each of the following modes.\n");
     printf("The mode used changes automatically when extensions are inserted/removed.\n");
-    printf("\t\"wiimote\" - used when the wiimote has no extension. (Motion Plus is ignored.)\n");
+    printf("\t\"wiimote\" - used when the wiimote has no extension. (A Motion Plus doesn't count.)\n");
     printf("\t\"nunchuk\" - used when a nunchuk is present.\n");
     printf("\t\"classic\" - used when a classic controller is present, or for a Wii U pro controller\n");
     printf("\t\"all\" - applies to all three modes.\n");
+    printf("Add \".<layer>\" to a mode, like \"nunchuk.media\", to change that mode in a layer.\n");
     return;
   }
   if (strcmp(args[0],"events") == 0) {
     printf("The recognized names for input buttons are:\n");
-    printf("up, down, left, right, a, b, c, x, y, z, plus, minus, home, 1, 2, l, r, zl, zr, thumbl, thumbr\n\n");
+    printf("up, down, left, right, a, b, c, x, y, z, plus, minus, home, 1, 2, l, r, zl, zr, thumbl, thumbr\n");
+    printf("waggle, n_waggle - shaking the wiimote or nunchuk\n");
+    printf("\t(optionally followed by how hard, as a percent of gravity (default %d),\n",WAGGLE_THRESHOLD);
+    printf("\t and the milliseconds to wait before the next shake (default %d))\n\n",WAGGLE_COOLDOWN);
 
     printf("The recognized names for input axes are:\n");
     printf("\taccelx - wiimote acceleration x (tilt forward/back)\n");
     printf("\taccely - wiimote acceleration y (tilt left/right)\n");
     printf("\taccelz - wiimote acceleration z\n");
     printf("\tir_x,ir_y - Infared \"pointer\" axes.\n");
+    printf("\tir_dist,ir_roll - sensor bar distance and roll (needs \"ir multiple\")\n");
     printf("\tn_accelx - nunchuk acceleration x (tilt forward/back)\n");
     printf("\tn_accely - nunchuk acceleration y (tilt left/right)\n");
     printf("\tn_accelz - nunchuk acceleration z\n");
     printf("\tn_x, n_y - nunchuck control stick axes\n");
     printf("\tleft_x, left_y - classic/pro left stick axes\n");
     printf("\tright_x, right_y - classic/pro right stick axes\n");
-    /*Not implemented at the moment.
-     * printf("\tbal_fl,bal_fr,bal_bl,bal_br - balance board front/back left/right axes\n");
-     */
+    printf("\tl_trigger, r_trigger - classic controller analog triggers\n");
+    printf("\tbal_fl,bal_fr,bal_bl,bal_br - balance board front/back left/right sensors\n");
     printf("\tbal_x,bal_y - balance board center-of-gravity axes.\n");
+    printf("\tbal_weight - total weight on the balance board, averaged to hold steady\n");
+    printf("\tgyro_x,gyro_y,gyro_z - Motion Plus rotation rates\n");
+    printf("\tpitch,roll,yaw - wiimote orientation from the Motion Plus and accelerometer\n");
+    printf("Any input axis can also be mapped to an output button. Add + or - to the axis\n");
+    printf("name for one direction (n_x- is left, n_y- is up), and optionally the percent\n");
+    printf("of full deflection that presses the button (default %d) and that releases it.\n",AXIS_PRESS_DEFAULT);
     printf("\n");
 
     printf("The recognized names for the synthetic gamepad output buttons are:\n");
@@ -199,16 +223,23 @@ void process_command(struct wiimoteglue_state *state, char *args[]) {
 
     printf("When mapped to a keyboard/mouse, these button mappings are available:\n");
     printf("\tleft_click, right_click, middle_click, key_a, key_leftshift, etc.\n");
-    printf("(look up uapi/linux/input.h for all key names, just make them lowercase)\n\n");
+    printf("(look up uapi/linux/input.h for all key names, just make them lowercase)\n");
+    printf("Add \"turbo [presses per second]\" at the end of a button mapping to repeat it while held.\n");
+    printf("Map a button to \"macro:<name>\" to play a macro, adding \"repeat\" to loop it while held.\n\n");
 
     printf("The recognized names for the output axes are:\n");
     printf("\tleft_x, left_y - left stick axes\n");
     printf("\tright_x, right_y - right stick axes\n");
+    printf("\tleft_trigger, right_trigger - analog triggers\n");
     printf("\tnone - an ignored axis\n");
 
     printf("\tmouse_x, mouse_y - aliases for left_x, left_y\n");
+    printf("\trel_x, rel_y - relative mouse motion; the input axis sets the speed\n");
+    printf("\twheel, hwheel - mouse scroll wheels, also driven by speed\n");
 
     printf("Add \"invert\" at the end of an axis mapping to invert it.\n");
+    printf("Buttons can be mapped to output axes too. Add + or - to the axis name for\n");
+    printf("the direction, and optionally how far, in percent, to push it while held.\n");
 
 
     return;
@@ -217,7 +248,10 @@ void process_command(struct wiimoteglue_state *state, char *args[]) {
     printf("The recognized extra features are:\n");
     printf("\taccel - process and output acceleration axis mappings\n");
     printf("\tir - process the wiimotes infared pointer axes\n");
-    printf("(currently no extra options for these features are recognized)\n");
+    printf("\t       (\"ir multiple\" tracks both sensor bar dots and undoes roll,\n");
+    printf("\t        \"ir predict\" also leads the pointer to hide camera lag)\n");
+    printf("\tgyro - process the Motion Plus gyro axes\n");
+    printf("\t       (\"gyro fusion\" also outputs the pitch/roll/yaw axes)\n");
     return;
   }
   if (strcmp(args[0],"map") == 0) {
@@ -226,12 +260,25 @@ void process_command(struct wiimoteglue_state *state, char *args[]) {
       /*The first argument was a mode name.
        *We assume the gamepad mapping by default.
        */
-      maps = lookup_mappings(state,"gamepad");
-      update_mapping(state,maps,args[1],args[2],args[3],args[4]);
+      maps = mappings_for_write(state,lookup_mappings(state,"gamepad"));
+      update_mapping(state,maps,args[1],args[2],args[3],&args[4]);
     } else {
-      maps = lookup_mappings(state,args[1]);
-      update_mapping(state,maps,args[2],args[3],args[4],args[5]);
+      maps = mappings_for_write(state,lookup_mappings(state,args[1]));
+      update_mapping(state,maps,args[2],args[3],args[4],&args[5]);
     }
+    mappings_changed(state,maps);
+    return;
+  }
+  if (strcmp(args[0],"curve") == 0) {
+    struct mode_mappings* maps;
+    if (mode_name_check(args[1]) >= 0) {
+      maps = mappings_for_write(state,lookup_mappings(state,"gamepad"));
+      update_curve(state,maps,args[1],args[2],&args[3]);
+    } else {
+      maps = mappings_for_write(state,lookup_mappings(state,args[1]));
+      update_curve(state,maps,args[2],args[3],&args[4]);
+    }
+    mappings_changed(state,maps);
     return;
   }
   if (strcmp(args[0],"enable") == 0) {
@@ -240,13 +287,14 @@ void process_command(struct wiimoteglue_state *state, char *args[]) {
       /*The first argument was a mode name.
        *We assume the gamepad mapping by default.
        */
-      maps = lookup_mappings(state,"gamepad");
+      maps = mappings_for_write(state,lookup_mappings(state,"gamepad"));
       toggle_setting(state,maps,1,args[1],args[2],args[3]);
 
     } else {
-      maps = lookup_mappings(state,args[1]);
+      maps = mappings_for_write(state,lookup_mappings(state,args[1]));
       toggle_setting(state,maps,1,args[2],args[3],args[4]);
     }
+    mappings_changed(state,maps);
     return;
   }
   if (strcmp(args[0],"disable") == 0) {
@@ -255,13 +303,14 @@ void process_command(struct wiimoteglue_state *state, char *args[]) {
       /*The first argument was a mode name.
        *We assume the gamepad mapping by default.
        */
-      maps = lookup_mappings(state,"gamepad");
+      maps = mappings_for_write(state,lookup_mappings(state,"gamepad"));
       toggle_setting(state,maps,0,args[1],args[2],args[3]);
 
     } else {
-      maps = lookup_mappings(state,args[1]);
+      maps = mappings_for_write(state,lookup_mappings(state,args[1]));
       toggle_setting(state,maps,0,args[2],args[3],args[4]);
     }
+    mappings_changed(state,maps);
     return;
   }
   if (strcmp(args[0],"load") == 0) {
@@ -296,57 +345,252 @@ void process_command(struct wiimoteglue_state *state, char *args[]) {
     device_command(state,args[1],args[2],args[3],args[4]);
     return;
   }
+  if (strcmp(args[0],"mouse") == 0) {
+    mouse_command(state,args[1],args[2],args[3],args[4]);
+    return;
+  }
+  if (strcmp(args[0],"layer") == 0) {
+    struct mode_mappings* maps;
+    if (args[3] == NULL) {
+      maps = mappings_for_write(state,lookup_mappings(state,"gamepad"));
+      layer_define(maps,args[1],args[2]);
+    } else {
+      maps = mappings_for_write(state,lookup_mappings(state,args[1]));
+      if (maps == NULL) {
+        printf("Mapping \"%s\" not found.\n",args[1]);
+        return;
+      }
+      layer_define(maps,args[2],args[3]);
+    }
+    mappings_changed(state,maps);
+    return;
+  }
+  if (strcmp(args[0],"macro") == 0) {
+    if (args[1] == NULL) {
+      list_macros();
+      printf("usage: macro <name> <step> [step] ...\n");
+      return;
+    }
+    macro_define(args[1],&args[2]);
+    return;
+  }
 
 
   printf("Command not recognized.\n");
 }
 
-void update_mapping(struct wiimoteglue_state *state, struct mode_mappings* maps, char *mode, char *in, char *out, char *opt) {
+/*"all", or "all.<layer>", stands for each of the three modes.*/
+static int expand_all_modes(char *mode, char expanded[3][2*WG_MAX_NAME_SIZE]) {
+  static char *modes[3] = {"wiimote", "nunchuk", "classic"};
+  int i;
+  if (strncmp(mode,"all",3) != 0 || (mode[3] != '\0' && mode[3] != '.'))
+    return 0;
+  for (i = 0; i < 3; i++)
+    snprintf(expanded[i],2*WG_MAX_NAME_SIZE,"%s%s",modes[i],mode+3);
+  return 1;
+}
+
+/*Splits "left_x-" into "left_x" and -1. Names without
+ *a + or - on the end are taken as positive.
+ */
+static int split_direction(char *name, char base[WG_MAX_NAME_SIZE]) {
+  int len = strlen(name);
+  strncpy(base,name,WG_MAX_NAME_SIZE-1);
+  base[WG_MAX_NAME_SIZE-1] = '\0';
+  if (len < 2 || len >= WG_MAX_NAME_SIZE || (name[len-1] != '+' && name[len-1] != '-'))
+    return 1;
+  base[len-1] = '\0';
+  return (name[len-1] == '-') ? -1 : 1;
+}
+
+/*A button's output, turbo rate and axis value go together.*/
+static void override_button(struct mode_mappings *maps, struct event_map *mapping, int button) {
+  mappings_override(maps,&mapping->button_map[button],sizeof(int16_t));
+  mappings_override(maps,&mapping->button_turbo[button],sizeof(int16_t));
+  mappings_override(maps,&mapping->button_value[button],sizeof(int16_t));
+}
+
+void update_mapping(struct wiimoteglue_state *state, struct mode_mappings* maps, char *mode, char *in, char *out, char *opts[]) {
   struct event_map *mapping = NULL;
 
 
   if (maps == NULL || mode == NULL || in == NULL || out == NULL) {
     printf("Invalid command format.\n");
     printf("usage: map [mapname] <mode> <wii input> <gamepad output> [invert]\n");
+    printf("       map [mapname] <mode> <wii button> <output button> [turbo [rate]]\n");
+    printf("       map [mapname] <mode> <wii button> macro:<name> [repeat]\n");
+    printf("       map [mapname] <mode> waggle|n_waggle <output button> [threshold [cooldown]]\n");
+    printf("       map [mapname] <mode> <wii axis>[+|-] <output button> [press %% [release %%]]\n");
+    printf("       map [mapname] <mode> <wii button> <output axis>[+|-] [percent]\n");
     printf("If the gamepad/keyboardmouse specifier is omitted, gamepad is assumed.\n");
     return;
   }
 
-  if (strcmp(mode,"wiimote") == 0) {
-    mapping = &maps->mode_no_ext;
-  } else if (strcmp(mode,"nunchuk") == 0) {
-    mapping = &maps->mode_nunchuk;
-  } else if (strcmp(mode,"classic") == 0) {
-    mapping = &maps->mode_classic;
-  } else if (strcmp(mode,"all") == 0) {
+  char expanded[3][2*WG_MAX_NAME_SIZE];
+  if (expand_all_modes(mode,expanded)) {
     /*This is rather hack-ish. oh well.*/
-    update_mapping(state,maps,"wiimote",in,out,opt);
-    update_mapping(state,maps,"nunchuk",in,out,opt);
-    update_mapping(state,maps,"classic",in,out,opt);
+    update_mapping(state,maps,expanded[0],in,out,opts);
+    update_mapping(state,maps,expanded[1],in,out,opts);
+    update_mapping(state,maps,expanded[2],in,out,opts);
     return;
   }
 
+  mapping = lookup_mode_map(maps,mode);
+
   if (mapping == NULL) {
-    printf("Controller mode \"%s\" not recognized.\n(Valid modes are \"wiimote\",\"nunchuk\", and \"classic\")\n",mode);
+    printf("Controller mode \"%s\" not recognized.\n(Valid modes are \"wiimote\",\"nunchuk\", and \"classic\",\n or \"<mode>.<layer>\" for a layer of a mapping)\n",mode);
+    return;
+  }
+
+  char *opt = opts[0];
+
+  if (strcmp(in,"waggle") == 0 || strcmp(in,"n_waggle") == 0) {
+    int new_key = get_output_key(out);
+    if (new_key == -2) {
+      printf("Output button \"%s\" not recognized. See \"events\" for valid values.\n",out);
+      return;
+    }
+
+    /*The threshold and cooldown are shared
+     *by the wiimote and nunchuk.
+     */
+    if (opt != NULL) {
+      int threshold = atoi(opt);
+      int cooldown = (opts[1] != NULL) ? atoi(opts[1]) : mapping->waggle_cooldown;
+      if (threshold < 1 || threshold > 1000) {
+        printf("The waggle threshold must be a percentage of gravity from 1 to 1000.\n");
+        return;
+      }
+      if (cooldown < 0 || cooldown > 10000) {
+        printf("The waggle cooldown must be from 0 to 10000 milliseconds.\n");
+        return;
+      }
+      mapping->waggle_threshold = threshold;
+      mapping->waggle_cooldown = cooldown;
+      mappings_override(maps,&mapping->waggle_threshold,sizeof(int16_t));
+      mappings_override(maps,&mapping->waggle_cooldown,sizeof(int16_t));
+    }
+
+    if (in[0] == 'n') {
+      mapping->nunchuk_waggle_button = new_key;
+      mappings_override(maps,&mapping->nunchuk_waggle_button,sizeof(int16_t));
+    } else {
+      mapping->waggle_button = new_key;
+      mappings_override(maps,&mapping->waggle_button,sizeof(int16_t));
+    }
     return;
   }
 
-  int *button = get_input_key(in,mapping->button_map);
+  int16_t *button = get_input_key(in,mapping->button_map);
   if (button != NULL) {
-      int new_key = get_output_key(out);
-      if (new_key == -2) {
-	printf("Output button \"%s\" not recognized. See \"events\" for valid values.\n",out);
-	return;
+      int new_key;
+      int turbo = 0;
+
+      if (strncmp(out,"macro:",6) == 0) {
+        int macro = macro_lookup(out+6);
+        if (macro < 0) {
+          printf("There is no macro named \"%s\". Define one with \"macro\" first.\n",out+6);
+          return;
+        }
+        new_key = WG_MACRO | macro;
+        if (opt != NULL && strcmp(opt,"repeat") == 0)
+          turbo = 1;
+      } else {
+        new_key = get_output_key(out);
+        if (new_key == -2) {
+          /*Maybe an axis, with a direction,
+           *for the button to push on.
+           */
+          char axis_name[WG_MAX_NAME_SIZE];
+          int direction = split_direction(out,axis_name);
+          int new_axis = get_output_axis(axis_name);
+          if (new_axis == -2 || new_axis == NO_MAP) {
+            printf("Output button \"%s\" not recognized. See \"events\" for valid values.\n",out);
+            return;
+          }
+
+          int percent = 100;
+          if (opt != NULL)
+            percent = atoi(opt);
+          if (percent < 1 || percent > 100) {
+            printf("How far a button pushes an axis must be from 1 to 100 percent.\n");
+            return;
+          }
+
+          *button = WG_BUTTON_AXIS | new_axis;
+          mapping->button_turbo[button - mapping->button_map] = 0;
+          mapping->button_value[button - mapping->button_map] = (direction < 0 ? -1 : 1) * percent * ABS_LIMIT / 100;
+          override_button(maps,mapping,button - mapping->button_map);
+          return;
+        }
+        if (opt != NULL && strcmp(opt,"turbo") == 0) {
+          turbo = DEFAULT_TURBO_RATE;
+          if (opts[1] != NULL)
+            turbo = atoi(opts[1]);
+          if (turbo < 1 || turbo > MAX_TURBO_RATE) {
+            printf("Turbo rates must be between 1 and %d presses per second.\n",MAX_TURBO_RATE);
+            return;
+          }
+        }
       }
 
       *button = new_key;
+      mapping->button_turbo[button - mapping->button_map] = turbo;
+      override_button(maps,mapping,button - mapping->button_map);
       return;
   }
 
-  int *axis = get_input_axis(in,mapping);
+  /*An axis name ending in + or - is for
+   *one direction, to map it to a button.
+   */
+  char axis_name[WG_MAX_NAME_SIZE];
+  int direction = split_direction(in,axis_name);
+  int16_t *axis = get_input_axis(axis_name,mapping);
 
   if (axis != NULL) {
     int new_axis = get_output_axis(out);
+    if (new_axis == -2) {
+      /*Pushed far enough, the axis presses a button.*/
+      int new_key = get_output_key(out);
+      if (new_key == -2) {
+        printf("Output button or axis \"%s\" not recognized. See \"events\" for valid values.\n",out);
+        return;
+      }
+
+      int press = AXIS_PRESS_DEFAULT;
+      if (opt != NULL)
+        press = atoi(opt);
+      int release = press - AXIS_HYSTERESIS;
+      if (opt != NULL && opts[1] != NULL)
+        release = atoi(opts[1]);
+      if (press < 1 || press > 100 || release < 0 || release > press) {
+        printf("The press point must be from 1 to 100 percent, and the release point no higher.\n");
+        return;
+      }
+
+      /*Keep whatever the other direction had.*/
+      int pos = 0;
+      int neg = 0;
+      if (axis[AXIS_CODE] != NO_MAP && (axis[AXIS_CODE] & WG_AXIS_BUTTON)) {
+        pos = axis[AXIS_CODE] & ~WG_AXIS_BUTTON;
+        neg = axis[AXIS_NEG_BUTTON];
+      }
+      if (new_key == NO_MAP)
+        new_key = 0;
+      if (direction < 0)
+        neg = new_key;
+      else
+        pos = new_key;
+
+      axis[AXIS_CODE] = WG_AXIS_BUTTON | pos;
+      axis[AXIS_NEG_BUTTON] = neg;
+      axis[AXIS_PRESS] = press * ABS_LIMIT / 100;
+      axis[AXIS_RELEASE] = release * ABS_LIMIT / 100;
+      if (pos == 0 && neg == 0)
+        axis[AXIS_CODE] = NO_MAP;
+      mappings_override(maps,axis,AXIS_FIELDS*sizeof(int16_t));
+      return;
+    }
     if (new_axis == -2) {
       printf("Output axis \"%s\" not recognized. See \"events\" for valid values.\n",out);
       return;
@@ -359,6 +603,7 @@ void update_mapping(struct wiimoteglue_state *state, struct mode_mappings* maps,
     } else {
       axis[1] = abs(axis[1]);
     }
+    mappings_override(maps,axis,AXIS_FIELDS*sizeof(int16_t));
     return;
   }
 
@@ -370,6 +615,168 @@ void update_mapping(struct wiimoteglue_state *state, struct mode_mappings* maps,
 
 }
 
+static void print_curve(char *in, int16_t *axis) {
+  struct response_params *params = response_curve_params(axis[AXIS_CURVE]);
+  printf("%s:%s",in,(axis[AXIS_SCALE] < 0) ? " invert" : "");
+  if (params == NULL) {
+    printf(" linear\n");
+    return;
+  }
+
+  printf(" deadzone %g antideadzone %g saturation %g",
+         params->deadzone*100, params->antideadzone*100, params->saturation*100);
+  if (params->custom_count) {
+    int i;
+    printf(" custom ");
+    for (i = 0; i < params->custom_count; i++)
+      printf("%s%g",(i > 0) ? "," : "",params->custom[i]);
+  } else {
+    printf(" exponent %g",params->exponent);
+  }
+  if (params->smooth_cutoff > 0)
+    printf(" smooth %g beta %g",params->smooth_cutoff,params->smooth_beta);
+  printf("\n");
+}
+
+void update_curve(struct wiimoteglue_state *state, struct mode_mappings* maps, char *mode, char *in, char *opts[]) {
+  struct event_map *mapping = NULL;
+
+  if (maps == NULL || mode == NULL || in == NULL) {
+    printf("Invalid command format.\n");
+    printf("usage: curve [mapname] <mode> <wii axis> [options]\n");
+    printf("Options (percentages are of full deflection):\n");
+    printf("\tdeadzone <percent> - ignore small movements\n");
+    printf("\tantideadzone <percent> - jump past a game's own deadzone\n");
+    printf("\tsaturation <percent> - reach full output early\n");
+    printf("\texponent <number> - 1 is linear, higher is finer near the center\n");
+    printf("\tcustom <y0,y1,...> - evenly spaced output levels from 0 to 1\n");
+    printf("\tinvert/noinvert - flip the axis direction\n");
+    printf("\tsmooth <Hz> - remove jitter; lower is smoother (accel and IR axes only, 0 is off)\n");
+    printf("\tbeta <number> - how quickly smoothing backs off during fast motion\n");
+    printf("\tlinear - remove the curve\n");
+    printf("With no options, the current curve is shown.\n");
+    return;
+  }
+
+  char expanded[3][2*WG_MAX_NAME_SIZE];
+  if (expand_all_modes(mode,expanded)) {
+    update_curve(state,maps,expanded[0],in,opts);
+    update_curve(state,maps,expanded[1],in,opts);
+    update_curve(state,maps,expanded[2],in,opts);
+    return;
+  }
+
+  mapping = lookup_mode_map(maps,mode);
+
+  if (mapping == NULL) {
+    printf("Controller mode \"%s\" not recognized.\n(Valid modes are \"wiimote\",\"nunchuk\", and \"classic\",\n or \"<mode>.<layer>\" for a layer of a mapping)\n",mode);
+    return;
+  }
+
+  int16_t *axis = get_input_axis(in,mapping);
+  if (axis == NULL) {
+    printf("Input axis \"%s\" not recognized. See \"events\" for valid values.\n",in);
+    return;
+  }
+
+  if (opts[0] == NULL) {
+    print_curve(in,axis);
+    return;
+  }
+
+  /*Start from the current curve, so options can be changed one at a time.*/
+  struct response_params params;
+  struct response_params *old = response_curve_params(axis[AXIS_CURVE]);
+  if (old != NULL) {
+    params = *old;
+  } else {
+    response_default_params(&params);
+  }
+  int scale = axis[AXIS_SCALE];
+
+  int i;
+  for (i = 0; opts[i] != NULL; i++) {
+    char *opt = opts[i];
+    char *value = opts[i+1];
+
+    if (strcmp(opt,"invert") == 0) {
+      scale = -abs(scale);
+      continue;
+    }
+    if (strcmp(opt,"noinvert") == 0) {
+      scale = abs(scale);
+      continue;
+    }
+    if (strcmp(opt,"linear") == 0) {
+      response_default_params(&params);
+      continue;
+    }
+
+    if (value == NULL) {
+      printf("Curve option \"%s\" needs a value.\n",opt);
+      return;
+    }
+    i++;
+
+    if (strcmp(opt,"deadzone") == 0) {
+      params.deadzone = atof(value) / 100;
+    } else if (strcmp(opt,"antideadzone") == 0) {
+      params.antideadzone = atof(value) / 100;
+    } else if (strcmp(opt,"saturation") == 0) {
+      params.saturation = atof(value) / 100;
+    } else if (strcmp(opt,"exponent") == 0) {
+      params.exponent = atof(value);
+      params.custom_count = 0;
+      memset(params.custom,0,sizeof(params.custom));
+    } else if (strcmp(opt,"smooth") == 0) {
+      params.smooth_cutoff = atof(value);
+    } else if (strcmp(opt,"beta") == 0) {
+      params.smooth_beta = atof(value);
+    } else if (strcmp(opt,"custom") == 0) {
+      char *point;
+      memset(params.custom,0,sizeof(params.custom));
+      params.custom_count = 0;
+      while ((point = strsep(&value,",")) != NULL && params.custom_count < MAX_CUSTOM_POINTS) {
+        params.custom[params.custom_count++] = atof(point);
+      }
+      if (params.custom_count < 2) {
+        printf("A custom curve needs at least two points.\n");
+        return;
+      }
+    } else {
+      printf("Curve option \"%s\" not recognized.\n",opt);
+      return;
+    }
+  }
+
+  /*NaN gets past every comparison below, so check for it first.*/
+  int bad_point = 0;
+  for (i = 0; i < params.custom_count; i++) {
+    if (!isfinite(params.custom[i]) || params.custom[i] < 0 || params.custom[i] > 1)
+      bad_point = 1;
+  }
+  if (!isfinite(params.deadzone) || !isfinite(params.antideadzone) || !isfinite(params.saturation)
+      || !isfinite(params.exponent) || !isfinite(params.smooth_cutoff) || !isfinite(params.smooth_beta)
+      || bad_point
+      || params.deadzone < 0 || params.deadzone >= 1 || params.antideadzone < 0 || params.antideadzone >= 1
+      || params.saturation <= params.deadzone || params.saturation > 1 || params.exponent <= 0
+      || params.smooth_cutoff < 0 || params.smooth_beta < 0) {
+    printf("Invalid curve. The deadzone and antideadzone must be from 0 to 99,\n");
+    printf("the saturation between the deadzone and 100, the exponent positive,\n");
+    printf("smooth and beta must not be negative, and custom points must be from 0 to 1.\n");
+    return;
+  }
+
+  int curve = response_curve_get(&params);
+  if (curve < 0)
+    return;
+
+  response_curve_unref(axis[AXIS_CURVE]);
+  axis[AXIS_SCALE] = scale;
+  axis[AXIS_CURVE] = curve;
+  mappings_override(maps,axis,AXIS_FIELDS*sizeof(int16_t));
+}
+
 void toggle_setting(struct wiimoteglue_state *state, struct mode_mappings* maps, int active, char *mode, char *setting, char *opt) {
   struct event_map *mapping = NULL;
 
@@ -379,41 +786,60 @@ void toggle_setting(struct wiimoteglue_state *state, struct mode_mappings* maps,
     return;
   }
 
-  if (strcmp(mode,"wiimote") == 0) {
-    mapping = &maps->mode_no_ext;
-  } else if (strcmp(mode,"nunchuk") == 0) {
-    mapping = &maps->mode_nunchuk;
-  } else if (strcmp(mode,"classic") == 0) {
-    mapping = &maps->mode_classic;
-  } else if (strcmp(mode,"all") == 0) {
+  char expanded[3][2*WG_MAX_NAME_SIZE];
+  if (expand_all_modes(mode,expanded)) {
     /* also hackish*/
-    toggle_setting(state,maps,active,"wiimote",setting,opt);
-    toggle_setting(state,maps,active,"nunchuk",setting,opt);
-    toggle_setting(state,maps,active,"classic",setting,opt);
+    toggle_setting(state,maps,active,expanded[0],setting,opt);
+    toggle_setting(state,maps,active,expanded[1],setting,opt);
+    toggle_setting(state,maps,active,expanded[2],setting,opt);
     return;
   }
 
+  mapping = lookup_mode_map(maps,mode);
+
   if (mapping == NULL) {
-    printf("Controller mode \"%s\" not recognized.\n(Valid modes are \"wiimote\",\"nunchuk\", and \"classic\")\n",mode);
+    printf("Controller mode \"%s\" not recognized.\n(Valid modes are \"wiimote\",\"nunchuk\", and \"classic\",\n or \"<mode>.<layer>\" for a layer of a mapping)\n",mode);
     return;
   }
 
   if (strcmp(setting, "accel") == 0) {
     mapping->accel_active = active;
-    wiimoteglue_update_all_wiimote_ifaces(&state->dev_list);
+    mappings_override(maps,&mapping->accel_active,sizeof(int16_t));
     return;
   }
 
   if (strcmp(setting, "ir") == 0) {
     int ir_count = 1;
 
+    int predict = 0;
+
     if (opt != NULL && strcmp(opt,"multiple") == 0) ir_count = 2;
+    if (opt != NULL && strcmp(opt,"predict") == 0) {
+      ir_count = 2;
+      predict = 1;
+    }
 
     if (!active) ir_count = 0;
 
-    /*currently multiple IR sources, or a single one are treated identically*/
+    /*"multiple" tracks both sensor bar dots,
+     *otherwise we just follow the leftmost one.
+     */
     mapping->IR_count = ir_count;
-    wiimoteglue_update_all_wiimote_ifaces(&state->dev_list);
+    mapping->IR_predict = active && predict;
+    mappings_override(maps,&mapping->IR_count,sizeof(int16_t));
+    mappings_override(maps,&mapping->IR_predict,sizeof(int16_t));
+    return;
+  }
+
+  if (strcmp(setting, "gyro") == 0) {
+    int gyro_active = 1;
+
+    if (opt != NULL && strcmp(opt,"fusion") == 0) gyro_active = 2;
+
+    if (!active) gyro_active = 0;
+
+    mapping->gyro_active = gyro_active;
+    mappings_override(maps,&mapping->gyro_active,sizeof(int16_t));
     return;
   }
 
@@ -436,25 +862,112 @@ int wiimoteglue_load_command_file(struct wiimoteglue_state *state, char *filenam
     return -1;
   }
   printf("Reading commands from file \'%s\'\n",filename);
+  wiimoteglue_inotify_watch_file(state,filename);
+
+  /*Mapping edits are held until the outermost file
+   *is done, then they are all applied at once.
+   */
+  int outermost = !state->staging;
+  state->staging = 1;
+
   int ret = 0;
+  int status = 0;
   while (ret >= 0) {
     if (state->load_lines > MAX_LOAD_LINES) {
       /*exceeded number of lines read, start backing out.*/
-      close(fd);
-      return -2;
+      status = -2;
+      break;
     }
     ret = wiimoteglue_handle_input(state, fd);
   }
 
   close(fd);
-  return 0;
 
+  if (outermost) {
+    state->staging = 0;
+    publish_pending_mappings(state);
+  }
+  return status;
+
+}
+
+int mouse_command(struct wiimoteglue_state *state, char *axis, char *speed, char *exponent, char *deadzone) {
+  static char *rel_names[WG_REL_NUM] = {"rel_x", "rel_y", "wheel", "hwheel"};
+  int i;
+
+  if (axis == NULL) {
+    printf("Relative mouse axes update %d times a second.\n",state->mouse_rate);
+    for (i = 0; i < WG_REL_NUM; i++) {
+      struct rel_curve *curve = &state->rel_curves[i];
+      printf("\t%s: speed %d, exponent %.2f, deadzone %d\n",rel_names[i],curve->speed,curve->exponent,curve->deadzone);
+    }
+    printf("(Pointer speeds are in counts/second, wheel speeds in notches/second.)\n");
+    printf("usage: mouse <rel_x|rel_y|pointer|wheel|hwheel> <speed> [exponent] [deadzone]\n");
+    printf("       mouse rate <updates per second>\n");
+    return 0;
+  }
+
+  if (speed == NULL) {
+    printf("usage: mouse <rel_x|rel_y|pointer|wheel|hwheel> <speed> [exponent] [deadzone]\n");
+    printf("       mouse rate <updates per second>\n");
+    return -1;
+  }
+
+  if (strcmp(axis,"rate") == 0) {
+    return mouse_set_rate(state,atoi(speed));
+  }
+
+  if (strcmp(axis,"pointer") == 0) {
+    /*Both pointer axes at once.*/
+    mouse_command(state,"rel_x",speed,exponent,deadzone);
+    return mouse_command(state,"rel_y",speed,exponent,deadzone);
+  }
+
+  for (i = 0; i < WG_REL_NUM; i++) {
+    if (strcmp(axis,rel_names[i]) == 0)
+      break;
+  }
+  if (i == WG_REL_NUM) {
+    printf("\'%s\' is not a relative mouse axis.\n",axis);
+    printf("Valid choices are rel_x, rel_y, pointer, wheel, and hwheel.\n");
+    return -1;
+  }
+
+  struct rel_curve curve = state->rel_curves[i];
+  curve.speed = atoi(speed);
+  if (exponent != NULL)
+    curve.exponent = atof(exponent);
+  if (exponent != NULL && deadzone != NULL)
+    curve.deadzone = atoi(deadzone);
+
+  if (curve.speed < 0 || curve.exponent <= 0 || curve.deadzone < 0 || curve.deadzone >= ABS_LIMIT) {
+    printf("Speed must not be negative, the exponent must be positive,\n");
+    printf("and the deadzone must be between 0 and %d.\n",ABS_LIMIT-1);
+    return -1;
+  }
+
+  state->rel_curves[i] = curve;
+  return mouse_update_timer(state);
 }
 
 int slot_command(struct wiimoteglue_state* state, char* slotname, char* setting, char* value) {
+  if (slotname != NULL && strcmp(slotname,"policy") == 0) {
+    int policy = slot_policy_lookup(setting);
+    if (policy < 0) {
+      printf("How should new devices pick a slot?\n");
+      printf("\"sticky\" (where it was last, if it's open), \"lowest\" (the lowest open one),\n");
+      printf("or \"round-robin\" (the next open one after the last handed out)\n");
+      printf("Currently \"%s\".\n",slot_policy_name(state->slot_alloc.policy));
+      return -1;
+    }
+    state->slot_alloc.policy = policy;
+    return 0;
+  }
+
   if (slotname == NULL || setting == NULL) {
     printf("usage: slot <slotnumber> <setting name> [value]\n");
-    printf("\tPossible settings: type, list, mapping, gamepad, keyboardmouse\n");
+    printf("\tPossible settings: type, list, mapping, gamepad, keyboardmouse, merge\n");
+    printf("   or: slot policy <sticky|lowest|round-robin>\n");
     return -1;
   }
 
@@ -484,6 +997,19 @@ int slot_command(struct wiimoteglue_state* state, char* slotname, char* setting,
     return 0;
   }
 
+  if (strcmp(setting, "merge") == 0) {
+    int policy = merge_policy_lookup(value);
+    if (policy < 0) {
+      printf("How should axes from several devices in this slot be combined?\n");
+      printf("\"last\" (the most recent), \"max\" (the furthest pushed), or \"sum\"\n");
+      printf("(Buttons are held while any device holds them.)\n");
+      printf("Slot %s currently uses \"%s\".\n",slot->slot_name,merge_policy_name(slot->merge.policy));
+      return -1;
+    }
+    slot->merge.policy = policy;
+    return 0;
+  }
+
   if (strcmp(setting, "mapping") == 0) {
     if (value == NULL) {
       printf("Missing mapping name.\n");
@@ -564,7 +1090,7 @@ int assign_device(struct wiimoteglue_state *state, char *devname, char *slotname
 
   int ret;
   /*Both of these functions handle NULL slots correctly*/
-  ret = remove_device_from_slot(device);
+  ret = remove_device_from_slot(state,device);
   if (ret < 0) {
     printf("Something went wrong when removing from previous slot.\n");
     return -1;
@@ -579,8 +1105,10 @@ int assign_device(struct wiimoteglue_state *state, char *devname, char *slotname
   
   if (device->slot == NULL) {
     close_wii_device(state,device);
+    registry_forget_slot(state,device); /*so it doesn't come back there*/
   } else {
     open_wii_device(state,device);
+    registry_remember_device(state,device);
   }
 
   return 0;
@@ -588,9 +1116,10 @@ int assign_device(struct wiimoteglue_state *state, char *devname, char *slotname
 }
 
 int device_command(struct wiimoteglue_state *state, char *devname, char *command, char *value) {
-  if (devname == NULL || command == NULL || value == NULL) {
+  if (devname == NULL || command == NULL || (value == NULL && strcmp(command,"tare") != 0)) {
     printf("\"device <devname> mapping <mapname>\"\n");
     printf("\"device <name|addr> rename <name>\"\n");
+    printf("\"device <devname> tare [clear]\" - zero an empty balance board\n");
     return -1;
   }
 
@@ -608,6 +1137,10 @@ int device_command(struct wiimoteglue_state *state, char *devname, char *command
     }
 
     set_device_specific_mappings(dev,maps);
+    compute_device_map(state,dev);
+    if (maps == NULL)
+      registry_forget_mapping(state,dev);
+    registry_remember_device(state,dev);
     return 0;
   }
   
@@ -627,10 +1160,33 @@ int device_command(struct wiimoteglue_state *state, char *devname, char *command
         return -1;
       }
       struct wii_device_list* node = new_wii_device(state,devname);
+      if (node == NULL)
+        return -1;
       dev = node->dev;
     }
     
     strncpy(dev->id, value, WG_MAX_NAME_SIZE);
+    registry_remember_device(state,dev);
+    return 0;
+  }
+
+  if (strcmp(command,"tare") == 0) {
+    if (dev->type != BALANCE) {
+      printf("Device %s is not a balance board.\n",dev->id);
+      return -1;
+    }
+
+    if (value != NULL && strcmp(value,"clear") == 0) {
+      balance_clear_tare(&dev->balance);
+    } else if (balance_tare(&dev->balance) < 0) {
+      printf("No readings from %s yet. Is it in a slot?\n",dev->id);
+      return -1;
+    } else {
+      printf("Tared %s at %d, %d, %d, %d (front left/right, back left/right).\n",dev->id,
+             dev->balance.tare[WG_BAL_FL],dev->balance.tare[WG_BAL_FR],
+             dev->balance.tare[WG_BAL_BL],dev->balance.tare[WG_BAL_BR]);
+    }
+    registry_remember_device(state,dev);
     return 0;
   }
 
@@ -640,12 +1196,14 @@ int device_command(struct wiimoteglue_state *state, char *devname, char *command
 }
 
 int mapping_command(struct wiimoteglue_state *state, char *mapname, char *command, char *value) {
-  if (mapname == NULL || command == NULL || value == NULL || strcmp(command,"copyfrom") != 0) {
-    printf("Currently only \"mapping <mapname> copyfrom <mapname>\" is supported.\n");
+  if (mapname == NULL || command == NULL || value == NULL
+      || (strcmp(command,"copyfrom") != 0 && strcmp(command,"parent") != 0)) {
+    printf("usage: mapping <mapname> copyfrom <mapname>\n");
+    printf("       mapping <mapname> parent <mapname|none>\n");
     return -1;
   }
 
-  struct mode_mappings *maps = lookup_mappings(state,mapname);
+  struct mode_mappings *maps = mappings_for_edit(state,lookup_mappings(state,mapname));
   if (maps == NULL) {
     printf("Could not find mapping \"%s\"\n",mapname);
     return -1;
@@ -657,11 +1215,28 @@ int mapping_command(struct wiimoteglue_state *state, char *mapname, char *comman
       printf("Could not find mapping \"%s\"\n",value);
       return -1;
     }
+    if (mapsrc->pending != NULL)
+      mapsrc = mapsrc->pending; /*copy what this file has set up so far*/
 
     copy_mappings(maps,mapsrc);
+    if (maps->own != NULL)
+      mappings_override(maps,maps->data,sizeof(struct mapping_data)); /*all of it is its own now*/
+    mappings_changed(state,maps);
     return 0;
   }
 
+  if (strcmp(command,"parent") == 0) {
+    struct mode_mappings *parent = NULL;
+    if (strcmp(value,"none") != 0) {
+      parent = lookup_mappings(state,value);
+      if (parent == NULL) {
+        printf("Could not find mapping \"%s\"\n",value);
+        return -1;
+      }
+    }
+    return mappings_set_parent(state,maps,parent);
+  }
+
 
   return 0;
 }
@@ -686,8 +1261,17 @@ int list_objects(struct wiimoteglue_state *state, char *type, char *option) {
   if (strcmp(type,"mappings") == 0)
     return list_mappings(state,option);
 
+  if (strcmp(type,"macros") == 0)
+    return list_macros();
+
+  if (strcmp(type,"timers") == 0)
+    return list_timers(state);
+
+  if (strcmp(type,"latency") == 0)
+    return list_latency(state,option);
+
   printf("\"%s\" not recognized.\n",type);
-  printf("Valid list types are \"devices\", \"slots\", and \"mappings\"\n");
+  printf("Valid list types are \"devices\", \"slots\", \"mappings\", \"macros\", \"timers\", and \"latency\"\n");
   return -1;
 
 
@@ -697,7 +1281,14 @@ void display_mapping(struct mode_mappings *maps) {
   /*This will be more useful
    *when there is more info to show about a map.
    */
+  int i;
   printf("- %s\n",maps->name);
+  if (maps->parent != NULL)
+    printf("\tinherits from: %s\n",maps->parent->name);
+  for (i = 0; i < MAX_LAYERS; i++) {
+    if (maps->data->layers[i].name[0] != '\0')
+      printf("\tlayer: %s\n",maps->data->layers[i].name);
+  }
   if (maps->reference_count > 1)
     printf("\t%d devices/slots using this as their specific mapping\n",maps->reference_count-1);
 }
@@ -713,6 +1304,83 @@ int list_mappings(struct wiimoteglue_state *state, char *option) {
   return 0;
 }
 
+int list_timers(struct wiimoteglue_state *state) {
+  struct timer_wheel *wheel = &state->timers;
+  struct rusage usage;
+
+  printf("%d timer(s) running\n",wheel->count);
+  if (wheel->fired > 0) {
+    printf("%lu fired, on average %.3fms late (%.3fms at worst)\n",wheel->fired,
+           wheel->late_total / (double) wheel->fired / 1000000,
+           wheel->late_max / 1000000.0);
+  }
+
+  /*Handy for seeing what all those turbo buttons cost.*/
+  if (getrusage(RUSAGE_SELF,&usage) == 0) {
+    printf("CPU time used so far: %ld.%03lds user, %ld.%03lds system\n",
+           (long) usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec / 1000,
+           (long) usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec / 1000);
+  }
+  return 0;
+}
+
+/*"list latency reset" starts the counts over,
+ *say before and after trying --realtime.
+ */
+int list_latency(struct wiimoteglue_state *state, char *option) {
+  struct latency_stats *stats = &state->event_latency;
+  int i;
+
+  if (option != NULL && strcmp(option,"reset") == 0) {
+    memset(stats,0,sizeof(*stats));
+    state->timers.fired = 0;
+    state->timers.late_total = 0;
+    state->timers.late_max = 0;
+    state->busy_poll.wakeups = 0;
+    state->busy_poll.caught = 0;
+    state->busy_poll.spent_total = 0;
+    printf("Latency counts cleared.\n");
+    return 0;
+  }
+
+  if (state->realtime_priority > 0)
+    printf("Running real-time, priority %d\n",state->realtime_priority);
+  else
+    printf("Not running real-time\n");
+
+  if (stats->count == 0) {
+    printf("No input events yet.\n");
+    return 0;
+  }
+
+  double mean = stats->total / (double) stats->count;
+  double variance = stats->total_sq / stats->count - mean * mean;
+  printf("%lu input events, %.3fms on average from the kernel to the virtual device\n",
+         stats->count, mean / 1000);
+  printf("jitter (standard deviation) %.3fms, %.3fms at worst\n",
+         (variance > 0 ? sqrt(variance) : 0) / 1000, stats->max / 1000.0);
+
+  int limit = LATENCY_FIRST_BUCKET_US;
+  for (i = 0; i < LATENCY_BUCKETS; i++) {
+    if (i < LATENCY_BUCKETS - 1)
+      printf("\tunder %6.3fms: %lu\n", limit / 1000.0, stats->buckets[i]);
+    else
+      printf("\t  over %6.3fms: %lu\n", limit / 2000.0, stats->buckets[i]);
+    limit *= 2;
+  }
+
+  if (state->timers.fired > 0)
+    printf("Timers: on average %.3fms late (%.3fms at worst)\n",
+           state->timers.late_total / (double) state->timers.fired / 1000000,
+           state->timers.late_max / 1000000.0);
+
+  struct busy_poll *poll = &state->busy_poll;
+  if (poll->window > 0 && poll->wakeups > 0)
+    printf("Busy-polling: %lu of %lu wakeups caught while spinning, %.3fs spent spinning\n",
+           poll->caught, poll->wakeups, poll->spent_total / 1000000000.0);
+  return 0;
+}
+
 int list_slots(struct wiimoteglue_state *state, char *option) {
   int i;
   for (i = 0; i <= state->num_slots; i++) {
@@ -724,6 +1392,8 @@ int list_slots(struct wiimoteglue_state *state, char *option) {
       printf("\tboards: %d\n",slot->has_board);
     if (slot->slot_specific_mappings != NULL)
       printf("\tspecific mapping: %s\n",slot->slot_specific_mappings->name);
+    if (slot->has_wiimote + slot->has_board > 1)
+      printf("\taxes merged by: %s\n",merge_policy_name(slot->merge.policy));
   }
 
   return 0;
@@ -760,7 +1430,10 @@ int create_user_item(struct wiimoteglue_state *state, char *type, char *name) {
     return -1;
   }
 
-  create_mappings(state,name);
+  struct map_list *created = create_mappings(state,name);
+  if (created == NULL)
+    return -1;
+  registry_restore_mapping(state,&created->maps);
   return 0;
 }
 
@@ -858,7 +1531,7 @@ struct wii_device * lookup_device(struct wii_device_list *devlist, char *name) {
     if (list_node->dev != NULL) {
       if (strncmp(name,list_node->dev->id,WG_MAX_NAME_SIZE) == 0)
 	return list_node->dev;
-      if (strncmp(name,list_node->dev->bluetooth_addr,18) == 0)
+      if (strncmp(name,list_node->dev->bluetooth_addr,BT_ADDR_SIZE) == 0)
 	return list_node->dev;
     }
 
@@ -1,4 +1,5 @@
 #include <linux/input.h>
+#include <stdlib.h>
 #include <string.h>
 #include "wiimoteglue.h"
 #include <stdio.h>
@@ -12,31 +13,117 @@
  *look in process_xwiimote_events.c
  */
 
+/*Inheriting mappings track which 16 bit entries of their
+ *mapping_data they set themselves, one bit each.
+ */
+#define MAP_UNITS (sizeof(struct mapping_data) / sizeof(int16_t))
+#define OWN_WORDS ((MAP_UNITS + 63) / 64)
+#define MAX_INHERIT_DEPTH 32
+
+/*Mappings come and go with command files, so
+ *they and their parts are recycled. See pool.c
+ */
+static struct pool map_pool = POOL_INIT(struct map_list, 8);
+static struct pool data_pool = POOL_INIT(struct mapping_data, 4);
+static struct pool own_pool = POOL_INIT(uint64_t[OWN_WORDS], 8);
+
+static void axis_curves(int16_t axes[][AXIS_FIELDS], int count, int delta) {
+  int i;
+  for (i = 0; i < count; i++) {
+    if (delta > 0)
+      response_curve_ref(axes[i][AXIS_CURVE]);
+    else
+      response_curve_unref(axes[i][AXIS_CURVE]);
+  }
+}
+
+/*Each axis with a response curve holds a reference to it.
+ *delta is 1 to take them, or -1 to drop them.
+ */
+static void event_map_curves(struct event_map *map, int delta) {
+  axis_curves(map->accel_map,sizeof(map->accel_map)/sizeof(map->accel_map[0]),delta);
+  axis_curves(map->stick_map,sizeof(map->stick_map)/sizeof(map->stick_map[0]),delta);
+  axis_curves(map->balance_map,sizeof(map->balance_map)/sizeof(map->balance_map[0]),delta);
+  axis_curves(map->IR_map,sizeof(map->IR_map)/sizeof(map->IR_map[0]),delta);
+  axis_curves(map->gyro_map,sizeof(map->gyro_map)/sizeof(map->gyro_map[0]),delta);
+}
+
+static void layer_curves(struct map_layer *layer, int delta) {
+  event_map_curves(&layer->mode_no_ext,delta);
+  event_map_curves(&layer->mode_nunchuk,delta);
+  event_map_curves(&layer->mode_classic,delta);
+}
+
+static void mapping_data_curves(struct mapping_data *data, int delta) {
+  int i;
+  event_map_curves(&data->mode_no_ext,delta);
+  event_map_curves(&data->mode_nunchuk,delta);
+  event_map_curves(&data->mode_classic,delta);
+  for (i = 0; i < MAX_LAYERS; i++)
+    layer_curves(&data->layers[i],delta);
+}
+
 void mappings_ref(struct mode_mappings *maps);
 void mappings_unref(struct mode_mappings *maps);
+void free_mappings(struct mode_mappings *maps);
+int forget_mapping(struct wiimoteglue_state *state, struct mode_mappings *maps);
+int init_blank_mappings(struct mode_mappings *maps);
+
+/*The mapping a device goes by: its own if it has one,
+ *then its slot's, then the default.
+ */
+static struct mode_mappings* device_mappings(struct wiimoteglue_state* state, struct wii_device* dev) {
+  if (dev->dev_specific_mappings != NULL)
+    return dev->dev_specific_mappings;
+  if (dev->slot != NULL && dev->slot->slot_specific_mappings != NULL)
+    return dev->slot->slot_specific_mappings;
+  return &state->head_map.maps;
+}
 
 int compute_device_map(struct wiimoteglue_state* state, struct wii_device* dev) {
   if (dev == NULL)
     return -1;
-  struct mode_mappings* maps = &state->head_map.maps;
-
-  if (dev->slot != NULL && dev->slot->slot_specific_mappings != NULL) {
-    maps = dev->slot->slot_specific_mappings;
-  }
-
-  if (dev->dev_specific_mappings != NULL)
-    maps = dev->dev_specific_mappings;
+  struct mode_mappings* maps = device_mappings(state,dev);
 
   if (dev->ifaces & XWII_IFACE_NUNCHUK) {
-    dev->map = &maps->mode_nunchuk;
+    dev->map = &maps->data->mode_nunchuk;
     dev->mode = NUNCHUK;
   } else if (dev->ifaces & (XWII_IFACE_CLASSIC_CONTROLLER | XWII_IFACE_PRO_CONTROLLER)) {
-    dev->map = &maps->mode_classic;
+    dev->map = &maps->data->mode_classic;
     dev->mode = CLASSIC;
   } else {
-    dev->map = &maps->mode_no_ext;
+    dev->map = &maps->data->mode_no_ext;
     dev->mode = NO_EXT;
   }
+  dev->base_map = dev->map;
+
+  /*Work out the layers for this mode now, so
+   *a shift button only has to swap a pointer.
+   */
+  int i;
+  memset(dev->shift_layer,0,sizeof(dev->shift_layer));
+  for (i = 0; i < MAX_LAYERS; i++) {
+    struct map_layer *layer = &maps->data->layers[i];
+    dev->layer_maps[i] = NULL;
+    if (layer->name[0] == '\0')
+      continue;
+
+    if (dev->mode == NUNCHUK)
+      dev->layer_maps[i] = &layer->mode_nunchuk;
+    else if (dev->mode == CLASSIC)
+      dev->layer_maps[i] = &layer->mode_classic;
+    else
+      dev->layer_maps[i] = &layer->mode_no_ext;
+
+    if (layer->shift >= 0 && layer->shift < XWII_KEY_NUM)
+      dev->shift_layer[layer->shift] = i + 1;
+  }
+
+  /*Stay in the same layer, if it's still there.*/
+  if (dev->layer > 0 && dev->layer_maps[dev->layer-1] != NULL)
+    dev->map = dev->layer_maps[dev->layer-1];
+  else
+    dev->layer = 0;
 
   wiimoteglue_update_wiimote_ifaces(dev);
 
@@ -70,18 +157,137 @@ int mode_name_check(char* mode_name) {
   if (mode_name == NULL)
     return -1;
 
-  if (strcmp(mode_name,"all") == 0)
+  /*A mode of a layer, like "wiimote.media", counts too.*/
+  char base[WG_MAX_NAME_SIZE];
+  strncpy(base,mode_name,WG_MAX_NAME_SIZE-1);
+  base[WG_MAX_NAME_SIZE-1] = '\0';
+  char *dot = strchr(base,'.');
+  if (dot != NULL)
+    *dot = '\0';
+
+  if (strcmp(base,"all") == 0)
     return 0;
-  if (strcmp(mode_name,"wiimote") == 0)
+  if (strcmp(base,"wiimote") == 0)
     return 1;
-  if (strcmp(mode_name,"nunchuk") == 0)
+  if (strcmp(base,"nunchuk") == 0)
     return 2;
-  if (strcmp(mode_name,"classic") == 0)
+  if (strcmp(base,"classic") == 0)
     return 3;
 
   return -2;
 }
 
+int layer_lookup(struct mode_mappings *maps, char *name) {
+  int i;
+  if (maps == NULL || name == NULL || name[0] == '\0')
+    return -1;
+  for (i = 0; i < MAX_LAYERS; i++) {
+    if (strncmp(maps->data->layers[i].name,name,WG_MAX_NAME_SIZE) == 0)
+      return i;
+  }
+  return -1;
+}
+
+/*Finds the event_map for a mode name, like "nunchuk",
+ *or for that mode in a layer, like "nunchuk.media".
+ *"all" isn't handled here.
+ */
+struct event_map* lookup_mode_map(struct mode_mappings *maps, char *mode) {
+  if (maps == NULL || mode == NULL)
+    return NULL;
+
+  char base[WG_MAX_NAME_SIZE];
+  strncpy(base,mode,WG_MAX_NAME_SIZE-1);
+  base[WG_MAX_NAME_SIZE-1] = '\0';
+
+  struct event_map *no_ext = &maps->data->mode_no_ext;
+  struct event_map *nunchuk = &maps->data->mode_nunchuk;
+  struct event_map *classic = &maps->data->mode_classic;
+
+  char *layer_name = strchr(base,'.');
+  if (layer_name != NULL) {
+    *layer_name++ = '\0';
+    int i = layer_lookup(maps,layer_name);
+    if (i < 0)
+      return NULL;
+    no_ext = &maps->data->layers[i].mode_no_ext;
+    nunchuk = &maps->data->layers[i].mode_nunchuk;
+    classic = &maps->data->layers[i].mode_classic;
+  }
+
+  if (strcmp(base,"wiimote") == 0)
+    return no_ext;
+  if (strcmp(base,"nunchuk") == 0)
+    return nunchuk;
+  if (strcmp(base,"classic") == 0)
+    return classic;
+  return NULL;
+}
+
+/*Creates a layer selected by holding the given button,
+ *or changes its button. A new layer starts out as a copy
+ *of the mapping's modes. A button of "none" removes it.
+ */
+int layer_define(struct mode_mappings *maps, char *name, char *button) {
+  if (maps == NULL || name == NULL || button == NULL) {
+    printf("usage: layer [mapname] <layer name> <wii button|none>\n");
+    return -1;
+  }
+
+  int i = layer_lookup(maps,name);
+
+  if (strcmp(button,"none") == 0) {
+    if (i < 0) {
+      printf("There is no layer named \"%s\".\n",name);
+      return -1;
+    }
+    layer_curves(&maps->data->layers[i],-1);
+    memset(&maps->data->layers[i],0,sizeof(maps->data->layers[i]));
+    mappings_override(maps,&maps->data->layers[i],sizeof(maps->data->layers[i]));
+    return 0;
+  }
+
+  if (strlen(name) >= WG_MAX_NAME_SIZE || strchr(name,'.') != NULL) {
+    printf("Layer names must be shorter than %d characters, with no \".\"\n",WG_MAX_NAME_SIZE);
+    return -1;
+  }
+
+  int16_t buttons[XWII_KEY_NUM];
+  int16_t *key = get_input_key(button,buttons);
+  if (key == NULL) {
+    printf("Input button \"%s\" not recognized. See \"events\" for valid values.\n",button);
+    return -1;
+  }
+  int shift = key - buttons;
+
+  int j;
+  for (j = 0; j < MAX_LAYERS; j++) {
+    if (j != i && maps->data->layers[j].name[0] != '\0' && maps->data->layers[j].shift == shift) {
+      printf("That button already selects the layer \"%s\".\n",maps->data->layers[j].name);
+      return -1;
+    }
+  }
+
+  if (i < 0) {
+    for (i = 0; i < MAX_LAYERS && maps->data->layers[i].name[0] != '\0'; i++);
+    if (i == MAX_LAYERS) {
+      printf("Too many layers (the limit is %d per mapping).\n",MAX_LAYERS);
+      return -1;
+    }
+    struct map_layer *layer = &maps->data->layers[i];
+    strncpy(layer->name,name,WG_MAX_NAME_SIZE-1);
+    layer->mode_no_ext = maps->data->mode_no_ext;
+    layer->mode_nunchuk = maps->data->mode_nunchuk;
+    layer->mode_classic = maps->data->mode_classic;
+    layer_curves(layer,1);
+    mappings_override(maps,layer,sizeof(*layer));
+  }
+
+  maps->data->layers[i].shift = shift;
+  mappings_override(maps,&maps->data->layers[i].shift,sizeof(int));
+  return 0;
+}
+
 struct mode_mappings* lookup_mappings(struct wiimoteglue_state* state, char* map_name) {
   if (map_name == NULL)
     return NULL;
@@ -98,20 +304,64 @@ struct mode_mappings* lookup_mappings(struct wiimoteglue_state* state, char* map
   return NULL;
 }
 
+static void mapping_data_unref(struct mapping_data *data) {
+  if (data == NULL)
+    return;
+  data->refs--;
+  if (data->refs <= 0) {
+    mapping_data_curves(data,-1);
+    pool_free(&data_pool,data);
+  }
+}
+
+/*Copying a mapping doesn't copy its modes and layers,
+ *it just shares them. mappings_unshare() makes the real
+ *copy once one side is edited, so "copyfrom" and the
+ *private copies made while loading a file are cheap
+ *until something actually changes.
+ */
 int copy_mappings(struct mode_mappings *dest, struct mode_mappings *src) {
- char *name = dest->name;
- memcpy(dest,src,sizeof(struct mode_mappings));
- dest->name = name;
- return 0;
+  if (dest->data == src->data)
+    return 0;
+  if (src->data != NULL)
+    src->data->refs++;
+  mapping_data_unref(dest->data);
+  dest->data = src->data;
+  return 0;
+}
+
+/*Give this mapping modes and layers of its own before
+ *writing to them. Returns 1 if it had to copy them,
+ *0 if they were already its own, and -1 on failure.
+ */
+int mappings_unshare(struct mode_mappings *maps) {
+  struct mapping_data *data = maps->data;
+  if (data != NULL && data->refs == 1)
+    return 0;
+
+  struct mapping_data *copy = pool_alloc(&data_pool);
+  if (copy == NULL) {
+    printf("Out of memory copying mapping \"%s\"\n",maps->name);
+    return -1;
+  }
+  if (data != NULL) {
+    *copy = *data;
+    mapping_data_curves(copy,1);
+    data->refs--;
+  }
+  copy->refs = 1;
+  maps->data = copy;
+  return 1;
 }
 
 struct map_list* create_mappings(struct wiimoteglue_state *state, char *name) {
   if (name == NULL)
     return NULL;
 
-  struct map_list *new_map = calloc(1,sizeof(struct map_list));
-  new_map->maps.name = calloc(WG_MAX_NAME_SIZE,sizeof(char));
-  strncpy(new_map->maps.name,name,WG_MAX_NAME_SIZE);
+  struct map_list *new_map = pool_alloc(&map_pool);
+  if (new_map == NULL)
+    return NULL;
+  strncpy(new_map->maps.name,name,WG_MAX_NAME_SIZE-1);
 
   new_map->next = &state->head_map;
   new_map->prev = state->head_map.prev;
@@ -121,7 +371,10 @@ struct map_list* create_mappings(struct wiimoteglue_state *state, char *name) {
 
   mappings_ref(&new_map->maps);
 
-  init_blank_mappings(&new_map->maps);
+  if (init_blank_mappings(&new_map->maps) < 0) {
+    forget_mapping(state,&new_map->maps);
+    return NULL;
+  }
 
   return new_map;
 
@@ -144,6 +397,12 @@ int forget_mapping(struct wiimoteglue_state *state, struct mode_mappings *maps)
     return -1;
   }
 
+  if (maps->pending != NULL) {
+    /*Edits from a file still loading are dropped too.*/
+    free_mappings(maps->pending);
+    maps->pending = NULL;
+  }
+
   /*cut it out of the mapping list,
    *but don't delete it if some slot
    *or device is still using it.
@@ -174,22 +433,417 @@ void mappings_unref(struct mode_mappings *maps) {
   if (maps->reference_count == 0) {
 
     printf("mapping \"%s\" is unreferenced and deleted.\n",maps->name);
-    free(maps->name);
-    free(get_map_list_container(maps));
+    free_mappings(maps);
   }
 
 }
 
+void free_mappings(struct mode_mappings *maps) {
+  if (maps->parent != NULL)
+    mappings_unref(maps->parent);
+  pool_free(&own_pool,maps->own);
+  mapping_data_unref(maps->data);
+  pool_free(&map_pool,get_map_list_container(maps));
+}
+
+/*Command files don't edit mappings in place.
+ *The first edit to a mapping during a file load
+ *makes a private copy, and the rest of the file
+ *edits that copy. publish_pending_mappings() then
+ *swaps the copies in all at once, so no device ever
+ *translates an event with a half-loaded mapping.
+ */
+struct mode_mappings* mappings_for_edit(struct wiimoteglue_state *state, struct mode_mappings *maps) {
+  if (maps == NULL || !state->staging)
+    return maps;
+
+  if (maps->pending != NULL)
+    return maps->pending;
+
+  if (maps != &state->head_map.maps && maps->reference_count <= 1)
+    return maps; /*Only the mapping list knows about it; no device reads it.*/
+
+  struct map_list *copy = pool_alloc(&map_pool);
+  if (copy == NULL)
+    return NULL;
+  strncpy(copy->maps.name,maps->name,WG_MAX_NAME_SIZE-1);
+  copy_mappings(&copy->maps,maps);
+  if (maps->parent != NULL) {
+    copy->maps.own = pool_alloc(&own_pool);
+    if (copy->maps.own == NULL) {
+      free_mappings(&copy->maps);
+      return NULL;
+    }
+    memcpy(copy->maps.own,maps->own,OWN_WORDS * sizeof(uint64_t));
+    copy->maps.parent = maps->parent;
+    mappings_ref(maps->parent);
+  }
+
+  /*It takes over the mapping list's reference when published.*/
+  copy->maps.reference_count = 1;
+
+  maps->pending = &copy->maps;
+  return maps->pending;
+}
+
+/*For edits that change what a mapping maps, rather than
+ *replacing it wholesale. Call mappings_changed() afterwards;
+ *until then, devices may still read the data it shared.
+ */
+struct mode_mappings* mappings_for_write(struct wiimoteglue_state *state, struct mode_mappings *maps) {
+  maps = mappings_for_edit(state,maps);
+  if (maps == NULL)
+    return NULL;
+
+  if (mappings_unshare(maps) < 0)
+    return NULL;
+  return maps;
+}
+
+/* Mapping inheritance.
+ *
+ * A mapping with a parent keeps a full, flattened copy of
+ * what it maps: its own entries, and its parent's for the
+ * rest. Devices read that like any other mapping, so
+ * inheritance costs nothing per event. When a mapping
+ * changes, everything below it is flattened again.
+ */
+
+static unsigned int flatten_gen;
+
+void mappings_override(struct mode_mappings *maps, void *entry, size_t size) {
+  if (maps == NULL || maps->own == NULL || size == 0)
+    return;
+  size_t first = ((char*)entry - (char*)maps->data) / sizeof(int16_t);
+  size_t last = ((char*)entry - (char*)maps->data + size - 1) / sizeof(int16_t);
+  if (last >= MAP_UNITS)
+    return;
+  for (; first <= last; first++)
+    maps->own[first/64] |= 1ULL << (first%64);
+}
+
+/*Is maps, or anything it inherits from, the ancestor? While
+ *a file loads, this follows the parents as they will be once
+ *it's published, going through any pending copies. A chain
+ *too long to be real is taken as a loop.
+ */
+static int mappings_descends_from(struct mode_mappings *maps, struct mode_mappings *ancestor) {
+  int depth;
+  if (ancestor->pending != NULL)
+    ancestor = ancestor->pending;
+  for (depth = 0; maps != NULL; depth++, maps = maps->parent) {
+    if (depth >= MAX_INHERIT_DEPTH)
+      return 1;
+    if (maps->pending != NULL)
+      maps = maps->pending;
+    if (maps == ancestor)
+      return 1;
+  }
+  return 0;
+}
+
+/*Copy in everything this mapping doesn't set itself,
+ *after doing the same for its parent.
+ */
+static void mappings_flatten(struct mode_mappings *maps, unsigned int gen) {
+  if (maps->flat_gen == gen)
+    return;
+  maps->flat_gen = gen;
+  if (maps->parent == NULL || maps->own == NULL)
+    return;
+
+  mappings_flatten(maps->parent,gen);
+  if (maps->parent->data == NULL)
+    return;
+
+  /*Only copy the data if something actually changed,
+   *so a copy that still matches stays shared.
+   */
+  int unshared = 0;
+  char *src = (char*)maps->parent->data;
+  size_t w;
+  for (w = 0; w < OWN_WORDS; w++) {
+    uint64_t inherited = ~maps->own[w];
+    while (inherited) {
+      size_t i = w*64 + __builtin_ctzll(inherited);
+      inherited &= inherited - 1;
+      if (i >= MAP_UNITS)
+        break;
+      char *unit = (char*)maps->data + i*sizeof(int16_t);
+      if (memcmp(unit,src + i*sizeof(int16_t),sizeof(int16_t)) == 0)
+        continue;
+      if (!unshared) {
+        if (mappings_unshare(maps) < 0)
+          return;
+        /*Curves may be copied in or over; count them again after.*/
+        mapping_data_curves(maps->data,-1);
+        unshared = 1;
+        unit = (char*)maps->data + i*sizeof(int16_t);
+      }
+      memcpy(unit,src + i*sizeof(int16_t),sizeof(int16_t));
+    }
+  }
+  if (unshared)
+    mapping_data_curves(maps->data,1);
+}
+
+static void mappings_flatten_all(struct wiimoteglue_state *state) {
+  struct map_list *list_node = state->head_map.next;
+  flatten_gen++;
+  for (; list_node != NULL && list_node != &state->head_map; list_node = list_node->next)
+    mappings_flatten(&list_node->maps,flatten_gen);
+}
+
+/* Who uses a mapping.
+ *
+ * Each mapping keeps a list of the slots and devices that
+ * picked it, threaded through them, so after a change only
+ * their devices are recomputed. Those lists are short and
+ * only change on commands, so they're singly linked.
+ */
+
+void mappings_add_slot_user(struct mode_mappings *maps, struct virtual_controller *slot) {
+  slot->next_map_user = maps->slot_users;
+  maps->slot_users = slot;
+}
+
+void mappings_remove_slot_user(struct mode_mappings *maps, struct virtual_controller *slot) {
+  struct virtual_controller **link = &maps->slot_users;
+  for (; *link != NULL; link = &(*link)->next_map_user) {
+    if (*link == slot) {
+      *link = slot->next_map_user;
+      break;
+    }
+  }
+  slot->next_map_user = NULL;
+}
+
+void mappings_add_device_user(struct mode_mappings *maps, struct wii_device *dev) {
+  dev->next_map_user = maps->dev_users;
+  maps->dev_users = dev;
+}
+
+void mappings_remove_device_user(struct mode_mappings *maps, struct wii_device *dev) {
+  struct wii_device **link = &maps->dev_users;
+  for (; *link != NULL; link = &(*link)->next_map_user) {
+    if (*link == dev) {
+      *link = dev->next_map_user;
+      break;
+    }
+  }
+  dev->next_map_user = NULL;
+}
+
+/*Recompute every device going by this mapping. Devices
+ *fall back on the default mapping without picking it,
+ *so for that one alone we have to look at all of them.
+ */
+static void mappings_update_users(struct wiimoteglue_state *state, struct mode_mappings *maps) {
+  struct wii_device *dev;
+  for (dev = maps->dev_users; dev != NULL; dev = dev->next_map_user)
+    compute_device_map(state,dev);
+
+  struct virtual_controller *slot;
+  for (slot = maps->slot_users; slot != NULL; slot = slot->next_map_user) {
+    struct wii_device_list *list_node = slot->dev_list.next;
+    for (; list_node != &slot->dev_list && list_node != NULL; list_node = list_node->next) {
+      dev = list_node->dev;
+      if (dev != NULL && dev->dev_specific_mappings == NULL)
+        compute_device_map(state,dev);
+    }
+  }
+
+  if (maps != &state->head_map.maps)
+    return;
+  struct wii_device_list *list_node = state->dev_list.next;
+  for (; list_node != &state->dev_list && list_node != NULL; list_node = list_node->next) {
+    dev = list_node->dev;
+    if (dev != NULL && dev->dev_specific_mappings == NULL
+        && (dev->slot == NULL || dev->slot->slot_specific_mappings == NULL))
+      compute_device_map(state,dev);
+  }
+}
+
+/*Call after changing a mapping outside of a file load.
+ *Flattens the mappings that inherit from it, and updates
+ *the devices using it or them.
+ */
+int mappings_changed(struct wiimoteglue_state *state, struct mode_mappings *maps) {
+  if (maps == NULL || state->staging)
+    return 0;
+
+  struct map_list *list_node = state->head_map.next;
+  flatten_gen++;
+  mappings_flatten(maps,flatten_gen);
+  mappings_update_users(state,maps);
+  for (; list_node != NULL && list_node != &state->head_map; list_node = list_node->next) {
+    if (&list_node->maps != maps && mappings_descends_from(&list_node->maps,maps)) {
+      mappings_flatten(&list_node->maps,flatten_gen);
+      mappings_update_users(state,&list_node->maps);
+    }
+  }
+  return 0;
+}
+
+/*Sets or clears (with NULL) the parent of a mapping. A new
+ *parent starts it over as a copy of that parent; only what
+ *it maps afterwards is its own. Without a parent, it keeps
+ *what it has as its own.
+ */
+int mappings_set_parent(struct wiimoteglue_state *state, struct mode_mappings *maps, struct mode_mappings *parent) {
+  if (maps == NULL)
+    return -1;
+  if (maps == &state->head_map.maps || maps == state->head_map.maps.pending) {
+    printf("The default mapping \"%s\" can't inherit from another.\n",maps->name);
+    return -1;
+  }
+  if (parent != NULL && mappings_descends_from(parent,maps)) {
+    printf("\"%s\" already inherits from \"%s\" (or goes more than %d deep).\n",
+           parent->name,maps->name,MAX_INHERIT_DEPTH);
+    return -1;
+  }
+
+  if (parent == NULL) {
+    pool_free(&own_pool,maps->own);
+    maps->own = NULL;
+  } else if (maps->own == NULL) {
+    maps->own = pool_alloc(&own_pool);
+    if (maps->own == NULL)
+      return -1;
+    /*The refcount isn't an entry to inherit.*/
+    mappings_override(maps,maps->data,offsetof(struct mapping_data,mode_no_ext));
+  }
+
+  if (parent != NULL)
+    mappings_ref(parent);
+  if (maps->parent != NULL)
+    mappings_unref(maps->parent);
+  maps->parent = parent;
+
+  mappings_changed(state,maps);
+  return 0;
+}
+
+int swap_mappings_users(struct wiimoteglue_state *state, struct mode_mappings *old, struct mode_mappings *new) {
+  struct virtual_controller *slot;
+  for (slot = old->slot_users; slot != NULL; slot = slot->next_map_user) {
+    slot->slot_specific_mappings = new;
+    mappings_ref(new);
+    old->reference_count--;
+  }
+  new->slot_users = old->slot_users;
+  old->slot_users = NULL;
+
+  struct wii_device *dev;
+  for (dev = old->dev_users; dev != NULL; dev = dev->next_map_user) {
+    dev->dev_specific_mappings = new;
+    mappings_ref(new);
+    old->reference_count--;
+  }
+  new->dev_users = old->dev_users;
+  old->dev_users = NULL;
+
+  /*Mappings inheriting from the old one, and their
+   *copies from the file, inherit from the new one.
+   */
+  struct map_list *map_node = state->head_map.next;
+  for (; map_node != NULL && map_node != &state->head_map; map_node = map_node->next) {
+    struct mode_mappings *maps = &map_node->maps;
+    if (maps->pending != NULL && maps->pending->parent == old) {
+      maps->pending->parent = new;
+      mappings_ref(new);
+      old->reference_count--;
+    }
+    if (maps->parent == old) {
+      maps->parent = new;
+      mappings_ref(new);
+      old->reference_count--;
+    }
+  }
+  return 0;
+}
+
+int publish_pending_mappings(struct wiimoteglue_state *state) {
+  struct map_list *retired = NULL;
+  struct map_list *list_node = state->head_map.next;
+
+  struct mode_mappings *head_pending = state->head_map.maps.pending;
+  if (head_pending != NULL) {
+    /*The default mapping is the head of the mapping list
+     *and can't be swapped out, so its new contents are
+     *copied over instead. We're single-threaded, so
+     *no event can be translated in the middle of this.
+     */
+    state->head_map.maps.pending = NULL;
+    copy_mappings(&state->head_map.maps,head_pending);
+    free_mappings(head_pending);
+  }
+
+  while (list_node != NULL && list_node != &state->head_map) {
+    struct map_list *next = list_node->next;
+    struct mode_mappings *old = &list_node->maps;
+    struct mode_mappings *new = old->pending;
+
+    if (new != NULL) {
+      struct map_list *new_node = get_map_list_container(new);
+      old->pending = NULL;
+
+      /*Put the new mapping where the old one was in the list.*/
+      new_node->next = list_node->next;
+      new_node->prev = list_node->prev;
+      new_node->next->prev = new_node;
+      new_node->prev->next = new_node;
+
+      swap_mappings_users(state,old,new);
+
+      /*Devices still point into the old mapping until
+       *their maps are recomputed below, so the old one
+       *is kept alive until then.
+       */
+      list_node->next = retired;
+      list_node->prev = NULL;
+      retired = list_node;
+    }
+
+    list_node = next;
+  }
+
+  mappings_flatten_all(state);
+  wiimoteglue_compute_all_device_maps(state,&state->dev_list);
+
+  while (retired != NULL) {
+    struct map_list *next = retired->next;
+    retired->maps.reference_count--; /*the mapping list's reference*/
+    if (retired->maps.reference_count <= 0)
+      free_mappings(&retired->maps);
+    retired = next;
+  }
+
+  return 0;
+}
+
+
+/*Frees every mapping at once, on the way out.*/
+void mappings_close(struct wiimoteglue_state *state) {
+  state->head_map.next = &state->head_map;
+  state->head_map.prev = &state->head_map;
+  state->head_map.maps.data = NULL;
+  pool_destroy(&map_pool);
+  pool_destroy(&data_pool);
+  pool_destroy(&own_pool);
+}
 
 int init_keyboardmouse_mappings(struct mode_mappings *maps) {
+  if (mappings_unshare(maps) < 0)
+    return -1;
 
 
   /* Default wiimote only mapping.
    * Mainly useful for controlling media playback
    */
-  int *button_map = maps->mode_no_ext.button_map;
-  struct event_map *map = &maps->mode_no_ext;
-  memset(map, 0, sizeof(maps->mode_no_ext));
+  int16_t *button_map = maps->data->mode_no_ext.button_map;
+  struct event_map *map = &maps->data->mode_no_ext;
+  memset(map, 0, sizeof(maps->data->mode_no_ext));
   button_map[XWII_KEY_LEFT] = KEY_LEFT;
   button_map[XWII_KEY_RIGHT] = KEY_RIGHT;
   button_map[XWII_KEY_UP] = KEY_UP;
@@ -213,7 +867,7 @@ int init_keyboardmouse_mappings(struct mode_mappings *maps) {
   button_map[XWII_KEY_Z] = NO_MAP;
 
 
-  int no_ext_accel_map[6][2] = {
+  int16_t no_ext_accel_map[6][AXIS_FIELDS] = {
     {ABS_Y, -TILT_SCALE}, /*accelx*/
     {ABS_X, -TILT_SCALE}, /*accely*/
     {NO_MAP, TILT_SCALE},/*accelz*/
@@ -225,39 +879,62 @@ int init_keyboardmouse_mappings(struct mode_mappings *maps) {
 
   map->accel_active = 0;
 
-  int no_ext_stick_map[6][2] = {
+  int16_t no_ext_stick_map[8][AXIS_FIELDS] = {
     {NO_MAP, CLASSIC_SCALE},/*left_x*/
     {NO_MAP, -CLASSIC_SCALE},/*left_y*/
     {NO_MAP, CLASSIC_SCALE},/*right_x*/
     {NO_MAP, -CLASSIC_SCALE},/*right_y*/
     {NO_MAP, NUNCHUK_SCALE},/*n_x*/
     {NO_MAP, -NUNCHUK_SCALE},/*n_y*/
+    {NO_MAP, TRIGGER_SCALE},/*l_trigger*/
+    {NO_MAP, TRIGGER_SCALE},/*r_trigger*/
   };
   memcpy(map->stick_map, no_ext_stick_map, sizeof(no_ext_stick_map));
 
-  int no_ext_balance_map[6][2] = {
+  int16_t no_ext_balance_map[7][AXIS_FIELDS] = {
     {NO_MAP, ABS_LIMIT/600},/*bal_fl*/
     {NO_MAP, ABS_LIMIT/600},/*bal_fr*/
     {NO_MAP, ABS_LIMIT/600},/*bal_bl*/
     {NO_MAP, ABS_LIMIT/600},/*bal_br*/
     {ABS_X, ABS_LIMIT},/*bal_x*/
     {ABS_Y, ABS_LIMIT},/*bal_y*/
+    {NO_MAP, WEIGHT_SCALE},/*bal_weight*/
   };
   memcpy(map->balance_map, no_ext_balance_map, sizeof(no_ext_balance_map));
 
-  int no_ext_IR_map[2][2] = {
+  int16_t no_ext_IR_map[4][AXIS_FIELDS] = {
     {ABS_X, ABS_LIMIT/400},/*ir_x*/
     {ABS_Y, ABS_LIMIT/300},/*ir_y*/
+    {NO_MAP, ABS_LIMIT/256},/*ir_dist*/
+    {NO_MAP, ABS_LIMIT/1024},/*ir_roll*/
   };
   memcpy(map->IR_map, no_ext_IR_map, sizeof(no_ext_IR_map));
+  map->IR_predict = 0;
+
+  map->waggle_button = NO_MAP;
+  map->nunchuk_waggle_button = NO_MAP;
+  map->waggle_threshold = WAGGLE_THRESHOLD;
+  map->waggle_cooldown = WAGGLE_COOLDOWN;
+
+  int16_t no_ext_gyro_map[6][AXIS_FIELDS] = {
+    {NO_MAP, GYRO_SCALE},/*gyro_x*/
+    {NO_MAP, GYRO_SCALE},/*gyro_y*/
+    {NO_MAP, GYRO_SCALE},/*gyro_z*/
+    {NO_MAP, ORIENT_SCALE},/*pitch*/
+    {NO_MAP, ORIENT_SCALE},/*roll*/
+    {NO_MAP, YAW_SCALE},/*yaw*/
+  };
+  memcpy(map->gyro_map, no_ext_gyro_map, sizeof(no_ext_gyro_map));
+
+  map->gyro_active = 0;
 
   /*Default mapping with nunchuk.
    *I don't know what keyboard/mouse
    *mappings are reasonable.
    */
-  button_map = maps->mode_nunchuk.button_map;
-  map = &maps->mode_nunchuk;
-  memset(map, 0, sizeof(maps->mode_nunchuk));
+  button_map = maps->data->mode_nunchuk.button_map;
+  map = &maps->data->mode_nunchuk;
+  memset(map, 0, sizeof(maps->data->mode_nunchuk));
   button_map[XWII_KEY_LEFT] = KEY_LEFT;
   button_map[XWII_KEY_RIGHT] = KEY_RIGHT;
   button_map[XWII_KEY_UP] = KEY_UP;
@@ -280,7 +957,7 @@ int init_keyboardmouse_mappings(struct mode_mappings *maps) {
   button_map[XWII_KEY_C] = BTN_TL;
   button_map[XWII_KEY_Z] = BTN_TL2;
 
-  int nunchuk_accel_map[6][2] = {
+  int16_t nunchuk_accel_map[6][AXIS_FIELDS] = {
     {ABS_RX, TILT_SCALE}, /*accelx*/
     {ABS_RY, TILT_SCALE}, /*accely*/
     {NO_MAP, TILT_SCALE},/*accelz*/
@@ -292,40 +969,63 @@ int init_keyboardmouse_mappings(struct mode_mappings *maps) {
 
   map->accel_active = 0;
 
-  int nunchuk_stick_map[6][2] = {
+  int16_t nunchuk_stick_map[8][AXIS_FIELDS] = {
     {NO_MAP, CLASSIC_SCALE},/*left_x*/
     {NO_MAP, -CLASSIC_SCALE},/*left_y*/
     {NO_MAP, CLASSIC_SCALE},/*right_x*/
     {NO_MAP, -CLASSIC_SCALE},/*right_y*/
     {ABS_X, NUNCHUK_SCALE},/*n_x*/
     {ABS_Y, -NUNCHUK_SCALE},/*n_y*/
+    {NO_MAP, TRIGGER_SCALE},/*l_trigger*/
+    {NO_MAP, TRIGGER_SCALE},/*r_trigger*/
   };
   memcpy(map->stick_map, nunchuk_stick_map, sizeof(nunchuk_stick_map));
 
-  int nunchuk_balance_map[6][2] = {
+  int16_t nunchuk_balance_map[7][AXIS_FIELDS] = {
     {NO_MAP, ABS_LIMIT/600},/*bal_fl*/
     {NO_MAP, ABS_LIMIT/600},/*bal_fr*/
     {NO_MAP, ABS_LIMIT/600},/*bal_bl*/
     {NO_MAP, ABS_LIMIT/600},/*bal_br*/
     {ABS_X, ABS_LIMIT},/*bal_x*/
     {ABS_Y, ABS_LIMIT},/*bal_y*/
+    {NO_MAP, WEIGHT_SCALE},/*bal_weight*/
   };
   memcpy(map->balance_map, nunchuk_balance_map, sizeof(nunchuk_balance_map));
 
-  int nunchuk_IR_map[2][2] = {
+  int16_t nunchuk_IR_map[4][AXIS_FIELDS] = {
     {ABS_X, ABS_LIMIT/400},/*ir_x*/
     {ABS_Y, ABS_LIMIT/300},/*ir_y*/
+    {NO_MAP, ABS_LIMIT/256},/*ir_dist*/
+    {NO_MAP, ABS_LIMIT/1024},/*ir_roll*/
   };
   memcpy(map->IR_map, nunchuk_IR_map, sizeof(nunchuk_IR_map));
+  map->IR_predict = 0;
+
+  map->waggle_button = NO_MAP;
+  map->nunchuk_waggle_button = NO_MAP;
+  map->waggle_threshold = WAGGLE_THRESHOLD;
+  map->waggle_cooldown = WAGGLE_COOLDOWN;
+
+  int16_t nunchuk_gyro_map[6][AXIS_FIELDS] = {
+    {NO_MAP, GYRO_SCALE},/*gyro_x*/
+    {NO_MAP, GYRO_SCALE},/*gyro_y*/
+    {NO_MAP, GYRO_SCALE},/*gyro_z*/
+    {NO_MAP, ORIENT_SCALE},/*pitch*/
+    {NO_MAP, ORIENT_SCALE},/*roll*/
+    {NO_MAP, YAW_SCALE},/*yaw*/
+  };
+  memcpy(map->gyro_map, nunchuk_gyro_map, sizeof(nunchuk_gyro_map));
+
+  map->gyro_active = 0;
 
 
   /*Mapping for Classic-style controllers.
    *I don't know what keyboard/mouse
    *mappings are reasonable.
    */
-  button_map = maps->mode_classic.button_map;
-  map = &maps->mode_classic;
-  memset(map, 0, sizeof(maps->mode_classic));
+  button_map = maps->data->mode_classic.button_map;
+  map = &maps->data->mode_classic;
+  memset(map, 0, sizeof(maps->data->mode_classic));
   button_map[XWII_KEY_LEFT] = KEY_LEFT;
   button_map[XWII_KEY_RIGHT] = KEY_RIGHT;
   button_map[XWII_KEY_UP] = KEY_UP;
@@ -348,7 +1048,7 @@ int init_keyboardmouse_mappings(struct mode_mappings *maps) {
   button_map[XWII_KEY_C] = NO_MAP;
   button_map[XWII_KEY_Z] = NO_MAP;
 
-  int classic_accel_map[6][2] = {
+  int16_t classic_accel_map[6][AXIS_FIELDS] = {
     {ABS_RX, TILT_SCALE}, /*accelx*/
     {ABS_RY, TILT_SCALE}, /*accely*/
     {NO_MAP, TILT_SCALE},/*accelz*/
@@ -358,31 +1058,54 @@ int init_keyboardmouse_mappings(struct mode_mappings *maps) {
   };
   memcpy(map->accel_map,classic_accel_map,sizeof(classic_accel_map));
 
-  int classic_stick_map[6][2] = {
+  int16_t classic_stick_map[8][AXIS_FIELDS] = {
     {ABS_X, CLASSIC_SCALE},/*left_x*/
     {ABS_Y, -CLASSIC_SCALE},/*left_y*/
     {ABS_RX, CLASSIC_SCALE},/*right_x*/
     {ABS_RY, -CLASSIC_SCALE},/*right_y*/
     {NO_MAP, NUNCHUK_SCALE},/*n_x*/
     {NO_MAP, -NUNCHUK_SCALE},/*n_y*/
+    {NO_MAP, TRIGGER_SCALE},/*l_trigger*/
+    {NO_MAP, TRIGGER_SCALE},/*r_trigger*/
   };
   memcpy(map->stick_map, classic_stick_map, sizeof(classic_stick_map));
 
-  int classic_balance_map[6][2] = {
+  int16_t classic_balance_map[7][AXIS_FIELDS] = {
     {NO_MAP, ABS_LIMIT/600},/*bal_fl*/
     {NO_MAP, ABS_LIMIT/600},/*bal_fr*/
     {NO_MAP, ABS_LIMIT/600},/*bal_bl*/
     {NO_MAP, ABS_LIMIT/600},/*bal_br*/
     {ABS_X, ABS_LIMIT},/*bal_x*/
     {ABS_Y, ABS_LIMIT},/*bal_y*/
+    {NO_MAP, WEIGHT_SCALE},/*bal_weight*/
   };
   memcpy(map->balance_map, classic_balance_map, sizeof(classic_balance_map));
 
-  int classic_IR_map[2][2] = {
+  int16_t classic_IR_map[4][AXIS_FIELDS] = {
     {ABS_X, ABS_LIMIT/400},/*ir_x*/
     {ABS_Y, ABS_LIMIT/300},/*ir_y*/
+    {NO_MAP, ABS_LIMIT/256},/*ir_dist*/
+    {NO_MAP, ABS_LIMIT/1024},/*ir_roll*/
   };
   memcpy(map->IR_map, classic_IR_map, sizeof(classic_IR_map));
+  map->IR_predict = 0;
+
+  map->waggle_button = NO_MAP;
+  map->nunchuk_waggle_button = NO_MAP;
+  map->waggle_threshold = WAGGLE_THRESHOLD;
+  map->waggle_cooldown = WAGGLE_COOLDOWN;
+
+  int16_t classic_gyro_map[6][AXIS_FIELDS] = {
+    {NO_MAP, GYRO_SCALE},/*gyro_x*/
+    {NO_MAP, GYRO_SCALE},/*gyro_y*/
+    {NO_MAP, GYRO_SCALE},/*gyro_z*/
+    {NO_MAP, ORIENT_SCALE},/*pitch*/
+    {NO_MAP, ORIENT_SCALE},/*roll*/
+    {NO_MAP, YAW_SCALE},/*yaw*/
+  };
+  memcpy(map->gyro_map, classic_gyro_map, sizeof(classic_gyro_map));
+
+  map->gyro_active = 0;
 
 
 
@@ -391,15 +1114,17 @@ int init_keyboardmouse_mappings(struct mode_mappings *maps) {
 }
 
 int init_gamepad_mappings(struct mode_mappings *maps, char *name) {
+  if (mappings_unshare(maps) < 0)
+    return -1;
 
 
   /* Default wiimote only mapping.
    * Designed for playing simple games, with the wiimote
    * held horizontally. (DPAD on the left.)
    */
-  int *button_map = maps->mode_no_ext.button_map;
-  struct event_map *map = &maps->mode_no_ext;
-  memset(map, 0, sizeof(maps->mode_no_ext));
+  int16_t *button_map = maps->data->mode_no_ext.button_map;
+  struct event_map *map = &maps->data->mode_no_ext;
+  memset(map, 0, sizeof(maps->data->mode_no_ext));
   button_map[XWII_KEY_LEFT] = BTN_DPAD_DOWN;
   button_map[XWII_KEY_RIGHT] = BTN_DPAD_UP;
   button_map[XWII_KEY_UP] = BTN_DPAD_LEFT;
@@ -423,7 +1148,7 @@ int init_gamepad_mappings(struct mode_mappings *maps, char *name) {
   button_map[XWII_KEY_Z] = NO_MAP;
 
 
-  int no_ext_accel_map[6][2] = {
+  int16_t no_ext_accel_map[6][AXIS_FIELDS] = {
     {ABS_Y, -TILT_SCALE}, /*accelx*/
     {ABS_X, -TILT_SCALE}, /*accely*/
     {NO_MAP, TILT_SCALE},/*accelz*/
@@ -435,40 +1160,63 @@ int init_gamepad_mappings(struct mode_mappings *maps, char *name) {
 
   map->accel_active = 0;
 
-  int no_ext_stick_map[6][2] = {
+  int16_t no_ext_stick_map[8][AXIS_FIELDS] = {
     {NO_MAP, CLASSIC_SCALE},/*left_x*/
     {NO_MAP, -CLASSIC_SCALE},/*left_y*/
     {NO_MAP, CLASSIC_SCALE},/*right_x*/
     {NO_MAP, -CLASSIC_SCALE},/*right_y*/
     {NO_MAP, NUNCHUK_SCALE},/*n_x*/
     {NO_MAP, -NUNCHUK_SCALE},/*n_y*/
+    {NO_MAP, TRIGGER_SCALE},/*l_trigger*/
+    {NO_MAP, TRIGGER_SCALE},/*r_trigger*/
   };
   memcpy(map->stick_map, no_ext_stick_map, sizeof(no_ext_stick_map));
 
-  int no_ext_balance_map[6][2] = {
+  int16_t no_ext_balance_map[7][AXIS_FIELDS] = {
     {NO_MAP, ABS_LIMIT/600},/*bal_fl*/
     {NO_MAP, ABS_LIMIT/600},/*bal_fr*/
     {NO_MAP, ABS_LIMIT/600},/*bal_bl*/
     {NO_MAP, ABS_LIMIT/600},/*bal_br*/
     {ABS_X, ABS_LIMIT},/*bal_x*/
     {ABS_Y, ABS_LIMIT},/*bal_y*/
+    {NO_MAP, WEIGHT_SCALE},/*bal_weight*/
   };
   memcpy(map->balance_map, no_ext_balance_map, sizeof(no_ext_balance_map));
 
-  int no_ext_IR_map[2][2] = {
+  int16_t no_ext_IR_map[4][AXIS_FIELDS] = {
     {ABS_RX, ABS_LIMIT/400},/*ir_x*/
     {ABS_RY, ABS_LIMIT/300},/*ir_y*/
+    {NO_MAP, ABS_LIMIT/256},/*ir_dist*/
+    {NO_MAP, ABS_LIMIT/1024},/*ir_roll*/
   };
   memcpy(map->IR_map, no_ext_IR_map, sizeof(no_ext_IR_map));
+  map->IR_predict = 0;
+
+  map->waggle_button = NO_MAP;
+  map->nunchuk_waggle_button = NO_MAP;
+  map->waggle_threshold = WAGGLE_THRESHOLD;
+  map->waggle_cooldown = WAGGLE_COOLDOWN;
+
+  int16_t no_ext_gyro_map[6][AXIS_FIELDS] = {
+    {NO_MAP, GYRO_SCALE},/*gyro_x*/
+    {NO_MAP, GYRO_SCALE},/*gyro_y*/
+    {NO_MAP, GYRO_SCALE},/*gyro_z*/
+    {NO_MAP, ORIENT_SCALE},/*pitch*/
+    {NO_MAP, ORIENT_SCALE},/*roll*/
+    {NO_MAP, YAW_SCALE},/*yaw*/
+  };
+  memcpy(map->gyro_map, no_ext_gyro_map, sizeof(no_ext_gyro_map));
+
+  map->gyro_active = 0;
 
   /*Default mapping with nunchuk.
    *No acceleration, just buttons.
    *
    *
    */
-  button_map = maps->mode_nunchuk.button_map;
-  map = &maps->mode_nunchuk;
-  memset(map, 0, sizeof(maps->mode_nunchuk));
+  button_map = maps->data->mode_nunchuk.button_map;
+  map = &maps->data->mode_nunchuk;
+  memset(map, 0, sizeof(maps->data->mode_nunchuk));
   button_map[XWII_KEY_LEFT] = BTN_DPAD_LEFT;
   button_map[XWII_KEY_RIGHT] = BTN_DPAD_RIGHT;
   button_map[XWII_KEY_UP] = BTN_DPAD_UP;
@@ -491,7 +1239,7 @@ int init_gamepad_mappings(struct mode_mappings *maps, char *name) {
   button_map[XWII_KEY_C] = BTN_TL;
   button_map[XWII_KEY_Z] = BTN_TL2;
 
-  int nunchuk_accel_map[6][2] = {
+  int16_t nunchuk_accel_map[6][AXIS_FIELDS] = {
     {ABS_RX, TILT_SCALE}, /*accelx*/
     {ABS_RY, TILT_SCALE}, /*accely*/
     {NO_MAP, TILT_SCALE},/*accelz*/
@@ -503,31 +1251,54 @@ int init_gamepad_mappings(struct mode_mappings *maps, char *name) {
 
   map->accel_active = 0;
 
-  int nunchuk_stick_map[6][2] = {
+  int16_t nunchuk_stick_map[8][AXIS_FIELDS] = {
     {NO_MAP, CLASSIC_SCALE},/*left_x*/
     {NO_MAP, -CLASSIC_SCALE},/*left_y*/
     {NO_MAP, CLASSIC_SCALE},/*right_x*/
     {NO_MAP, -CLASSIC_SCALE},/*right_y*/
     {ABS_X, NUNCHUK_SCALE},/*n_x*/
     {ABS_Y, -NUNCHUK_SCALE},/*n_y*/
+    {NO_MAP, TRIGGER_SCALE},/*l_trigger*/
+    {NO_MAP, TRIGGER_SCALE},/*r_trigger*/
   };
   memcpy(map->stick_map, nunchuk_stick_map, sizeof(nunchuk_stick_map));
 
-  int nunchuk_balance_map[6][2] = {
+  int16_t nunchuk_balance_map[7][AXIS_FIELDS] = {
     {NO_MAP, ABS_LIMIT/600},/*bal_fl*/
     {NO_MAP, ABS_LIMIT/600},/*bal_fr*/
     {NO_MAP, ABS_LIMIT/600},/*bal_bl*/
     {NO_MAP, ABS_LIMIT/600},/*bal_br*/
     {ABS_X, ABS_LIMIT},/*bal_x*/
     {ABS_Y, ABS_LIMIT},/*bal_y*/
+    {NO_MAP, WEIGHT_SCALE},/*bal_weight*/
   };
   memcpy(map->balance_map, nunchuk_balance_map, sizeof(nunchuk_balance_map));
 
-  int nunchuk_IR_map[2][2] = {
+  int16_t nunchuk_IR_map[4][AXIS_FIELDS] = {
     {ABS_RX, ABS_LIMIT/400},/*ir_x*/
     {ABS_RY, ABS_LIMIT/300},/*ir_y*/
+    {NO_MAP, ABS_LIMIT/256},/*ir_dist*/
+    {NO_MAP, ABS_LIMIT/1024},/*ir_roll*/
   };
   memcpy(map->IR_map, nunchuk_IR_map, sizeof(nunchuk_IR_map));
+  map->IR_predict = 0;
+
+  map->waggle_button = NO_MAP;
+  map->nunchuk_waggle_button = NO_MAP;
+  map->waggle_threshold = WAGGLE_THRESHOLD;
+  map->waggle_cooldown = WAGGLE_COOLDOWN;
+
+  int16_t nunchuk_gyro_map[6][AXIS_FIELDS] = {
+    {NO_MAP, GYRO_SCALE},/*gyro_x*/
+    {NO_MAP, GYRO_SCALE},/*gyro_y*/
+    {NO_MAP, GYRO_SCALE},/*gyro_z*/
+    {NO_MAP, ORIENT_SCALE},/*pitch*/
+    {NO_MAP, ORIENT_SCALE},/*roll*/
+    {NO_MAP, YAW_SCALE},/*yaw*/
+  };
+  memcpy(map->gyro_map, nunchuk_gyro_map, sizeof(nunchuk_gyro_map));
+
+  map->gyro_active = 0;
 
 
   /*Mapping for Classic-style controllers.
@@ -535,9 +1306,9 @@ int init_gamepad_mappings(struct mode_mappings *maps, char *name) {
    *controllers use this. It matches the
    *Linux gamepad layout.
    */
-  button_map = maps->mode_classic.button_map;
-  map = &maps->mode_classic;
-  memset(map, 0, sizeof(maps->mode_classic));
+  button_map = maps->data->mode_classic.button_map;
+  map = &maps->data->mode_classic;
+  memset(map, 0, sizeof(maps->data->mode_classic));
   button_map[XWII_KEY_LEFT] = BTN_DPAD_LEFT;
   button_map[XWII_KEY_RIGHT] = BTN_DPAD_RIGHT;
   button_map[XWII_KEY_UP] = BTN_DPAD_UP;
@@ -560,7 +1331,7 @@ int init_gamepad_mappings(struct mode_mappings *maps, char *name) {
   button_map[XWII_KEY_C] = NO_MAP;
   button_map[XWII_KEY_Z] = NO_MAP;
 
-  int classic_accel_map[6][2] = {
+  int16_t classic_accel_map[6][AXIS_FIELDS] = {
     {ABS_RX, TILT_SCALE}, /*accelx*/
     {ABS_RY, TILT_SCALE}, /*accely*/
     {NO_MAP, TILT_SCALE},/*accelz*/
@@ -570,48 +1341,73 @@ int init_gamepad_mappings(struct mode_mappings *maps, char *name) {
   };
   memcpy(map->accel_map,classic_accel_map,sizeof(classic_accel_map));
 
-  int classic_stick_map[6][2] = {
+  int16_t classic_stick_map[8][AXIS_FIELDS] = {
     {ABS_X, CLASSIC_SCALE},/*left_x*/
     {ABS_Y, -CLASSIC_SCALE},/*left_y*/
     {ABS_RX, CLASSIC_SCALE},/*right_x*/
     {ABS_RY, -CLASSIC_SCALE},/*right_y*/
     {NO_MAP, NUNCHUK_SCALE},/*n_x*/
     {NO_MAP, -NUNCHUK_SCALE},/*n_y*/
+    {ABS_Z, TRIGGER_SCALE},/*l_trigger*/
+    {ABS_RZ, TRIGGER_SCALE},/*r_trigger*/
   };
   memcpy(map->stick_map, classic_stick_map, sizeof(classic_stick_map));
 
-  int classic_balance_map[6][2] = {
+  int16_t classic_balance_map[7][AXIS_FIELDS] = {
     {NO_MAP, ABS_LIMIT/600},/*bal_fl*/
     {NO_MAP, ABS_LIMIT/600},/*bal_fr*/
     {NO_MAP, ABS_LIMIT/600},/*bal_bl*/
     {NO_MAP, ABS_LIMIT/600},/*bal_br*/
     {ABS_X, ABS_LIMIT},/*bal_x*/
     {ABS_Y, ABS_LIMIT},/*bal_y*/
+    {NO_MAP, WEIGHT_SCALE},/*bal_weight*/
   };
   memcpy(map->balance_map, classic_balance_map, sizeof(classic_balance_map));
 
-  int classic_IR_map[2][2] = {
+  int16_t classic_IR_map[4][AXIS_FIELDS] = {
     {ABS_RX, ABS_LIMIT/400},/*ir_x*/
     {ABS_RY, ABS_LIMIT/300},/*ir_y*/
+    {NO_MAP, ABS_LIMIT/256},/*ir_dist*/
+    {NO_MAP, ABS_LIMIT/1024},/*ir_roll*/
   };
   memcpy(map->IR_map, classic_IR_map, sizeof(classic_IR_map));
+  map->IR_predict = 0;
+
+  map->waggle_button = NO_MAP;
+  map->nunchuk_waggle_button = NO_MAP;
+  map->waggle_threshold = WAGGLE_THRESHOLD;
+  map->waggle_cooldown = WAGGLE_COOLDOWN;
+
+  int16_t classic_gyro_map[6][AXIS_FIELDS] = {
+    {NO_MAP, GYRO_SCALE},/*gyro_x*/
+    {NO_MAP, GYRO_SCALE},/*gyro_y*/
+    {NO_MAP, GYRO_SCALE},/*gyro_z*/
+    {NO_MAP, ORIENT_SCALE},/*pitch*/
+    {NO_MAP, ORIENT_SCALE},/*roll*/
+    {NO_MAP, YAW_SCALE},/*yaw*/
+  };
+  memcpy(map->gyro_map, classic_gyro_map, sizeof(classic_gyro_map));
+
+  map->gyro_active = 0;
 
-  maps->name = name;
+  strncpy(maps->name,name,WG_MAX_NAME_SIZE-1);
 
   return 0;
 
 }
 
 int init_blank_mappings(struct mode_mappings *maps) {
+  if (mappings_unshare(maps) < 0)
+    return -1;
 
 
   /* Default wiimote only mapping.
    * This mapping is blank;
    * everthing is not mapped.
    */
-  int *button_map = maps->mode_no_ext.button_map;
-  struct event_map *map = &maps->mode_no_ext;
-  memset(map, 0, sizeof(maps->mode_no_ext));
+  int16_t *button_map = maps->data->mode_no_ext.button_map;
+  struct event_map *map = &maps->data->mode_no_ext;
+  memset(map, 0, sizeof(maps->data->mode_no_ext));
   button_map[XWII_KEY_LEFT] = NO_MAP;
   button_map[XWII_KEY_RIGHT] = NO_MAP;
   button_map[XWII_KEY_UP] = NO_MAP;
@@ -635,7 +1431,7 @@ int init_blank_mappings(struct mode_mappings *maps) {
   button_map[XWII_KEY_Z] = NO_MAP;
 
 
-  int no_ext_accel_map[6][2] = {
+  int16_t no_ext_accel_map[6][AXIS_FIELDS] = {
     {NO_MAP, -TILT_SCALE}, /*accelx*/
     {NO_MAP, -TILT_SCALE}, /*accely*/
     {NO_MAP, TILT_SCALE},/*accelz*/
@@ -647,38 +1443,61 @@ int init_blank_mappings(struct mode_mappings *maps) {
 
   map->accel_active = 0;
 
-  int no_ext_stick_map[6][2] = {
+  int16_t no_ext_stick_map[8][AXIS_FIELDS] = {
     {NO_MAP, CLASSIC_SCALE},/*left_x*/
     {NO_MAP, -CLASSIC_SCALE},/*left_y*/
     {NO_MAP, CLASSIC_SCALE},/*right_x*/
     {NO_MAP, -CLASSIC_SCALE},/*right_y*/
     {NO_MAP, NUNCHUK_SCALE},/*n_x*/
     {NO_MAP, -NUNCHUK_SCALE},/*n_y*/
+    {NO_MAP, TRIGGER_SCALE},/*l_trigger*/
+    {NO_MAP, TRIGGER_SCALE},/*r_trigger*/
   };
   memcpy(map->stick_map, no_ext_stick_map, sizeof(no_ext_stick_map));
 
-  int no_ext_balance_map[6][2] = {
+  int16_t no_ext_balance_map[7][AXIS_FIELDS] = {
     {NO_MAP, ABS_LIMIT/600},/*bal_fl*/
     {NO_MAP, ABS_LIMIT/600},/*bal_fr*/
     {NO_MAP, ABS_LIMIT/600},/*bal_bl*/
     {NO_MAP, ABS_LIMIT/600},/*bal_br*/
     {NO_MAP, ABS_LIMIT},/*bal_x*/
     {NO_MAP, ABS_LIMIT},/*bal_y*/
+    {NO_MAP, WEIGHT_SCALE},/*bal_weight*/
   };
   memcpy(map->balance_map, no_ext_balance_map, sizeof(no_ext_balance_map));
 
-  int no_ext_IR_map[2][2] = {
+  int16_t no_ext_IR_map[4][AXIS_FIELDS] = {
     {NO_MAP, ABS_LIMIT/400},/*ir_x*/
     {NO_MAP, ABS_LIMIT/300},/*ir_y*/
+    {NO_MAP, ABS_LIMIT/256},/*ir_dist*/
+    {NO_MAP, ABS_LIMIT/1024},/*ir_roll*/
   };
   memcpy(map->IR_map, no_ext_IR_map, sizeof(no_ext_IR_map));
+  map->IR_predict = 0;
+
+  map->waggle_button = NO_MAP;
+  map->nunchuk_waggle_button = NO_MAP;
+  map->waggle_threshold = WAGGLE_THRESHOLD;
+  map->waggle_cooldown = WAGGLE_COOLDOWN;
+
+  int16_t no_ext_gyro_map[6][AXIS_FIELDS] = {
+    {NO_MAP, GYRO_SCALE},/*gyro_x*/
+    {NO_MAP, GYRO_SCALE},/*gyro_y*/
+    {NO_MAP, GYRO_SCALE},/*gyro_z*/
+    {NO_MAP, ORIENT_SCALE},/*pitch*/
+    {NO_MAP, ORIENT_SCALE},/*roll*/
+    {NO_MAP, YAW_SCALE},/*yaw*/
+  };
+  memcpy(map->gyro_map, no_ext_gyro_map, sizeof(no_ext_gyro_map));
+
+  map->gyro_active = 0;
 
   /*Default mapping for nunchuk
    *and classic are the same:
    *all empty
    */
-  memcpy(&maps->mode_nunchuk,&maps->mode_no_ext,sizeof(struct event_map));
-  memcpy(&maps->mode_classic,&maps->mode_no_ext,sizeof(struct event_map));
+  memcpy(&maps->data->mode_nunchuk,&maps->data->mode_no_ext,sizeof(struct event_map));
+  memcpy(&maps->data->mode_classic,&maps->data->mode_no_ext,sizeof(struct event_map));
 
 
 
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <linux/input.h>
 #include <string.h>
@@ -11,24 +12,101 @@
  *so here it is.
  */
 
+struct wii_device* device_table_get(struct wiimoteglue_state *state, int index) {
+  struct device_table *table = &state->devices;
+  if (index < 0 || index >= table->size)
+    return NULL;
+  struct wii_device *dev = &table->chunks[index / DEVICE_CHUNK_SIZE][index % DEVICE_CHUNK_SIZE];
+  return dev->in_use ? dev : NULL;
+}
+
+/*Adds a chunk of spots to the device table.*/
+static int device_table_grow(struct device_table *table) {
+  int chunk = table->size / DEVICE_CHUNK_SIZE;
+  int i;
+  if (chunk >= MAX_DEVICE_CHUNKS)
+    return -1;
+  table->chunks[chunk] = calloc(DEVICE_CHUNK_SIZE,sizeof(struct wii_device));
+  if (table->chunks[chunk] == NULL)
+    return -1;
+  for (i = table->size; i < table->size + DEVICE_CHUNK_SIZE; i++)
+    table->free_spots[i/64] |= 1ULL << (i%64);
+  table->size += DEVICE_CHUNK_SIZE;
+  return 0;
+}
+
+/*Hands out the lowest free spot in the device table,
+ *adding a chunk if they are all taken. Spots are reused,
+ *never freed, so controllers coming and going don't
+ *churn the heap.
+ */
+static struct wii_device* device_table_alloc(struct wiimoteglue_state *state) {
+  struct device_table *table = &state->devices;
+  int i = -1;
+  int w;
+
+  for (w = 0; w < MAX_DEVICES/64 && i < 0; w++) {
+    if (table->free_spots[w])
+      i = w*64 + __builtin_ctzll(table->free_spots[w]);
+  }
+  if (i < 0) {
+    i = table->size;
+    if (device_table_grow(table) < 0)
+      return NULL;
+  }
+
+  table->free_spots[i/64] &= ~(1ULL << (i%64));
+  struct wii_device *dev = &table->chunks[i / DEVICE_CHUNK_SIZE][i % DEVICE_CHUNK_SIZE];
+  memset(dev,0,sizeof(*dev));
+  dev->index = i;
+  dev->in_use = 1;
+  dev->main_list = &dev->main_node;
+  dev->main_node.dev = dev;
+  dev->slot_list = &dev->slot_node;
+  dev->slot_node.dev = dev;
+  table->count++;
+  return dev;
+}
+
+static void device_table_free(struct wiimoteglue_state *state, struct wii_device *dev) {
+  struct device_table *table = &state->devices;
+  dev->in_use = 0;
+  table->free_spots[dev->index/64] |= 1ULL << (dev->index%64);
+  table->count--;
+}
+
+void device_table_close(struct wiimoteglue_state *state) {
+  struct device_table *table = &state->devices;
+  int i;
+  for (i = 0; i < MAX_DEVICE_CHUNKS; i++) {
+    free(table->chunks[i]);
+    table->chunks[i] = NULL;
+  }
+  memset(table->free_spots,0,sizeof(table->free_spots));
+  table->size = 0;
+  table->count = 0;
+}
+
 struct wii_device_list* new_wii_device(struct wiimoteglue_state *state, char* uniq) {
-  struct wii_device_list *list_node = calloc(1,sizeof(struct wii_device_list));
-  struct wii_device *dev = calloc(1,sizeof(struct wii_device));
-  list_node->dev = dev;
-  dev->main_list = list_node;
-  dev->slot_list = calloc(1,sizeof(struct wii_device_list));
-  dev->slot_list->dev = dev;
-
-  dev->bluetooth_addr = malloc(18*sizeof(char));
-  strncpy(dev->bluetooth_addr, uniq, 17);
-  dev->bluetooth_addr[17] = '\0';
-
-  dev->id = calloc(WG_MAX_NAME_SIZE,sizeof(char));
-  snprintf(dev->id,WG_MAX_NAME_SIZE,"dev%d",++(state->dev_count));
+  struct wii_device *dev = device_table_alloc(state);
+  if (dev == NULL) {
+    printf("Too many devices (the limit is %d).\n",MAX_DEVICES);
+    return NULL;
+  }
+  struct wii_device_list *list_node = dev->main_list;
+
+  strncpy(dev->bluetooth_addr, uniq, BT_ADDR_SIZE-1);
+
+  /*Skip any names remembered for other devices.*/
+  do {
+    snprintf(dev->id,WG_MAX_NAME_SIZE,"dev%d",++(state->dev_count));
+  } while (registry_id_in_use(state,dev->id,dev->bluetooth_addr) || lookup_device(&state->dev_list,dev->id) != NULL);
   
   dev->original_leds[0] = -2;
   dev->type = UNKNOWN;
 
+  registry_restore_device(state,dev);
+
   printf("\tid: %s\n\taddress %s\n",dev->id, dev->bluetooth_addr);
 
   list_node->next = &state->dev_list;
@@ -53,6 +131,10 @@ int add_wii_device(struct wiimoteglue_state *state, struct udev_device* udev) {
   if (dev == NULL) {
   
     struct wii_device_list* node = new_wii_device(state,uniq);
+    if (node == NULL) {
+      udev_device_unref(udev);
+      return -1;
+    }
     node->dev->udev = udev;
     dev = node->dev;
     
@@ -65,7 +147,7 @@ int add_wii_device(struct wiimoteglue_state *state, struct udev_device* udev) {
   }
   
   open_wii_device(state, dev);
-  remove_device_from_slot(dev);
+  remove_device_from_slot(state,dev);
   
   if (dev->slot == NULL) {
     auto_assign_slot(state, dev);
@@ -73,6 +155,8 @@ int add_wii_device(struct wiimoteglue_state *state, struct udev_device* udev) {
   
   if (dev->slot == NULL) {
     close_wii_device(state,dev);
+  } else {
+    registry_remember_device(state,dev);
   }
 
   return 0;
@@ -125,23 +209,20 @@ int open_wii_device(struct wiimoteglue_state *state, struct wii_device* dev) {
   }
 
   dev->fd = xwii_iface_get_fd(wiidev);
-  wiimoteglue_epoll_watch_wiimote(state->epfd, dev);
-
+  wiimoteglue_epoll_watch_wiimote(state, state->epfd, dev);
 
 
-  compute_device_map(state,dev);
 
-  if (dev->map->accel_active) {
-    xwii_iface_open(wiidev,XWII_IFACE_ACCEL);
-  } else {
-    xwii_iface_close(wiidev,XWII_IFACE_ACCEL);
-  }
+  motionplus_reset(&dev->fusion);
+  memset(&dev->ir,0,sizeof(dev->ir));
+  waggle_reset(&dev->waggle[0]);
+  waggle_reset(&dev->waggle[1]);
+  balance_reset(&dev->balance);
 
-  if (dev->map->IR_count) {
-    xwii_iface_open(wiidev,XWII_IFACE_IR);
-  } else {
-    xwii_iface_close(wiidev,XWII_IFACE_IR);
-  }
+  /*This also opens whichever of the accelerometer,
+   *IR, and Motion Plus the mapping needs.
+   */
+  compute_device_map(state,dev);
   
   /*LEDs only checked after opening,
    *and we want to store the state
@@ -157,7 +238,13 @@ int auto_assign_slot(struct wiimoteglue_state* state, struct wii_device *dev) {
 
   
   
-  if (state->num_slots > 0) {
+  struct virtual_controller *preferred = NULL;
+  if (state->slot_alloc.policy == SLOT_STICKY)
+    preferred = registry_preferred_slot(state,dev);
+  if (preferred != NULL && slot_has_room(preferred,dev->type)) {
+    /*It's a device we've seen before. Put it back where it was.*/
+    add_device_to_slot(state,dev,preferred);
+  } else if (state->num_slots > 0) {
     struct virtual_controller *slot = find_open_slot(state,dev->type);
     add_device_to_slot(state,dev,slot);
   } else {
@@ -207,17 +294,11 @@ int forget_wii_device(struct wiimoteglue_state* state, struct wii_device *dev) {
     list->next->prev = list->prev;
   }
 
-  if (dev->id != NULL) {
-    free(dev->id);
-  }
-  if (dev->bluetooth_addr != NULL) {
-    free(dev->bluetooth_addr);
-  }
+  /*Don't leave it on its mapping's list of users.*/
+  set_device_specific_mappings(dev,NULL);
 
   udev_device_unref(dev->udev);
-  free(dev->slot_list);
-  free(dev);
-  free(list);
+  device_table_free(state,dev);
   return 0;
 }
 
@@ -227,14 +308,16 @@ int close_wii_device(struct wiimoteglue_state* state, struct wii_device *dev) {
   }
   printf("Controller %s (%s) has been closed.\n",dev->id,dev->bluetooth_addr);
 
-  
+  timer_cancel(&dev->extension_timer);
+
+  wiimoteglue_epoll_unwatch_wiimote(state, state->epfd, dev);
   close(dev->fd);
 
   xwii_iface_unref(dev->xwii);
   dev->xwii = NULL;
   if (dev->slot != NULL) {
     printf("(It was assigned slot %s)\n",dev->slot->slot_name);
-    remove_device_from_slot(dev);
+    remove_device_from_slot(state,dev);
   }
 
   return 0;
@@ -244,13 +327,17 @@ int set_device_specific_mappings(struct wii_device *dev, struct mode_mappings *m
   if (dev ==  NULL)
     return -1;
 
-  if (dev->dev_specific_mappings != NULL)
+  if (dev->dev_specific_mappings != NULL) {
+    mappings_remove_device_user(dev->dev_specific_mappings,dev);
     mappings_unref(dev->dev_specific_mappings);
+  }
 
   dev->dev_specific_mappings = maps;
 
-  if (maps != NULL)
+  if (maps != NULL) {
     mappings_ref(maps);
+    mappings_add_device_user(maps,dev);
+  }
 
   return 0;
 
@@ -1,60 +1,160 @@
 #include <sys/epoll.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "wiimoteglue.h"
 
 /* We use epoll to wait for the next input to handle.
  * This should prevent using unecessary CPU time.
+ *
+ * It's level-triggered, and each wakeup reads just one
+ * event from each ready controller, so a chatty controller
+ * can't starve the others: every ready fd gets a turn
+ * before anyone gets a second one.
+ *
+ * With --busy-poll, we keep checking without sleeping for
+ * a short window after each event, since more input tends
+ * to follow soon, and waking from a sleep can take a while
+ * on a power-saving CPU. The spinning is capped at a share
+ * of each second, so a steady stream of events can't keep
+ * a CPU pegged.
  */
 
-#define EPOLL_MAX_EVENTS 10
-struct epoll_event event;
-struct epoll_event events[EPOLL_MAX_EVENTS];
+#define EPOLL_MIN_EVENTS 16
+#define NS_PER_SEC 1000000000ULL
 
-int wiimoteglue_epoll_init(int *epfd) {
-  *epfd = epoll_create(EPOLL_MAX_EVENTS);
-
-  memset(events,0, sizeof(events));
+int wiimoteglue_epoll_init(struct wiimoteglue_state* state, int *epfd) {
+  *epfd = epoll_create(EPOLL_MIN_EVENTS);
+  if (*epfd < 0) {
+    perror("epoll_create");
+    return -1;
+  }
 
+  state->events = NULL;
+  state->max_events = 0;
+  state->watched_fds = 0;
   return 0;
 }
 
-
-int wiimoteglue_epoll_watch_monitor(int epfd, int mon_fd, void *monitor) {
+/*Everything watched gets a spot in the event buffer, so one
+ *epoll_wait can return every ready fd. The buffer is only
+ *grown between waits, never while its events are being handled.
+ */
+static int epoll_watch(struct wiimoteglue_state* state, int epfd, int fd, void *ptr) {
+  struct epoll_event event;
   memset(&event, 0, sizeof(event));
 
   event.events = EPOLLIN | EPOLLPRI | EPOLLERR | EPOLLHUP;
-  event.data.ptr = monitor;
+  event.data.ptr = ptr;
+
+  int ret = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
+  if (ret == 0)
+    state->watched_fds++;
+  return ret;
+}
+
+static int epoll_grow_events(struct wiimoteglue_state* state) {
+  if (state->max_events >= state->watched_fds && state->events != NULL)
+    return 0;
+
+  int size = state->max_events ? state->max_events : EPOLL_MIN_EVENTS;
+  while (size < state->watched_fds)
+    size *= 2;
 
-  return epoll_ctl(epfd, EPOLL_CTL_ADD, mon_fd, &event);
+  struct epoll_event *events = realloc(state->events, size * sizeof(struct epoll_event));
+  if (events == NULL)
+    return -1; /*keep going with the old one*/
+  state->events = events;
+  state->max_events = size;
+  return 0;
+}
 
+int wiimoteglue_epoll_watch_monitor(struct wiimoteglue_state* state, int epfd, int mon_fd, void *monitor) {
+  return epoll_watch(state, epfd, mon_fd, monitor);
 }
 
 int wiimoteglue_epoll_watch_stdin(struct wiimoteglue_state* state, int epfd) {
-  memset(&event, 0, sizeof(event));
+  return epoll_watch(state, epfd, 0, state); //HACK magic constant
+}
 
-  event.events = EPOLLIN | EPOLLPRI | EPOLLERR | EPOLLHUP;
-  event.data.ptr = state;
+int wiimoteglue_epoll_watch_inotify(struct wiimoteglue_state* state, int epfd) {
+  return epoll_watch(state, epfd, state->inotify_fd, &state->inotify_fd);
+}
 
-  return epoll_ctl(epfd, EPOLL_CTL_ADD, 0, &event); //HACK magic constant
+int wiimoteglue_epoll_watch_timers(struct wiimoteglue_state* state, int epfd) {
+  return epoll_watch(state, epfd, state->timers.fd, &state->timers);
 }
 
-int wiimoteglue_epoll_watch_wiimote(int epfd, struct wii_device *device) {
+int wiimoteglue_epoll_watch_wiimote(struct wiimoteglue_state* state, int epfd, struct wii_device *device) {
   if (device == NULL) return 0; //TODO: ERROR HANDLING.
-  memset(&event, 0, sizeof(event));
+  return epoll_watch(state, epfd, device->fd, device);
+}
 
-  event.events = EPOLLIN | EPOLLPRI | EPOLLERR | EPOLLHUP;
-  event.data.ptr = device;
-  return epoll_ctl(epfd, EPOLL_CTL_ADD, device->fd, &event);
+int wiimoteglue_epoll_unwatch_wiimote(struct wiimoteglue_state* state, int epfd, struct wii_device *device) {
+  if (device == NULL) return 0;
+  int ret = epoll_ctl(epfd, EPOLL_CTL_DEL, device->fd, NULL);
+  if (ret == 0)
+    state->watched_fds--;
+  return ret;
+}
+
+void wiimoteglue_epoll_close(struct wiimoteglue_state* state, int epfd) {
+  close(epfd);
+  free(state->events);
+  state->events = NULL;
+  state->max_events = 0;
+}
+
+static int busy_poll_allowed(struct busy_poll *poll, uint64_t now) {
+  if (now - poll->last_event > poll->window)
+    return 0;
+  if (now - poll->period_start >= NS_PER_SEC) {
+    poll->period_start = now;
+    poll->spent = 0;
+  }
+  return poll->spent < poll->budget * (NS_PER_SEC / 100);
+}
+
+static int wait_for_events(int epfd, struct wiimoteglue_state *state) {
+  struct busy_poll *poll = &state->busy_poll;
+  int n;
+
+  epoll_grow_events(state);
+  if (state->events == NULL)
+    return -1;
+
+  if (poll->window > 0) {
+    uint64_t now = timer_now();
+    while (state->keep_looping > 0 && busy_poll_allowed(poll, now)) {
+      n = epoll_wait(epfd, state->events, state->max_events, 0);
+      uint64_t after = timer_now();
+      poll->spent += after - now;
+      poll->spent_total += after - now;
+      now = after;
+      if (n != 0) {
+        poll->wakeups++;
+        if (n > 0)
+          poll->caught++;
+        return n;
+      }
+    }
+  }
+
+  n = epoll_wait(epfd, state->events, state->max_events, -1);
+  poll->wakeups++;
+  return n;
 }
 
 void wiimoteglue_epoll_loop(int epfd, struct wiimoteglue_state *state) {
+  struct epoll_event *events;
   int n;
   int i;
 
   while (state->keep_looping > 0) {
-    n = epoll_wait(epfd, events, EPOLL_MAX_EVENTS, -1);
+    n = wait_for_events(epfd, state);
+    events = state->events;
     for (i = 0; i < n; i++) {
       if (events[i].data.ptr == state->monitor) {
 	//HANDLE UDEV STUFF
@@ -69,11 +169,21 @@ void wiimoteglue_epoll_loop(int epfd, struct wiimoteglue_state *state) {
           close(0);
 	printf("\n>>");
 	fflush(stdout);
+      } else if (events[i].data.ptr == &state->timers) {
+	//TURBO, MACROS, AND THE MOUSE
+	wiimoteglue_timers_handle_tick(state);
+      } else if (events[i].data.ptr == &state->inotify_fd) {
+	//A LOADED FILE CHANGED
+	wiimoteglue_inotify_handle_event(state);
+	printf("\n>>");
+	fflush(stdout);
       } else {
 	//HANDLE WII STUFF
 	wiimoteglue_handle_wii_event(state,events[i].data.ptr);
       }
     }
+    if (n > 0 && state->busy_poll.window > 0)
+      state->busy_poll.last_event = timer_now();
   }
 
 }
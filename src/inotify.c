@@ -0,0 +1,135 @@
+#include <sys/inotify.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "wiimoteglue.h"
+
+/* Watches command files that have been loaded,
+ * and loads them again whenever they change.
+ *
+ * We watch the directory a file is in rather than
+ * the file itself, since many editors save by writing
+ * a new file and renaming it over the old one.
+ */
+
+struct watched_file {
+  struct watched_file *next;
+  int wd;
+  int changed;
+  char *path; /*as it was given to "load"*/
+  char *name; /*just the part after the last '/'*/
+};
+
+int wiimoteglue_inotify_init(int *inotify_fd) {
+  *inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (*inotify_fd < 0) {
+    perror("inotify");
+    return -1;
+  }
+
+  return 0;
+}
+
+int wiimoteglue_inotify_watch_file(struct wiimoteglue_state *state, char *filename) {
+  if (state->inotify_fd < 0 || filename == NULL)
+    return 0;
+
+  struct watched_file *file = state->watched_files;
+  for (; file != NULL; file = file->next) {
+    if (strcmp(file->path,filename) == 0)
+      return 0; /*Already watching it.*/
+  }
+
+  char dir[1024];
+  char *slash = strrchr(filename,'/');
+  if (slash == NULL) {
+    strcpy(dir,".");
+  } else if (slash == filename) {
+    strcpy(dir,"/");
+  } else {
+    size_t len = slash - filename;
+    if (len >= sizeof(dir))
+      return -1;
+    memcpy(dir,filename,len);
+    dir[len] = '\0';
+  }
+
+  int wd = inotify_add_watch(state->inotify_fd,dir,IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (wd < 0) {
+    printf("Could not watch \'%s\' for changes.\n",filename);
+    perror("inotify_add_watch");
+    return -1;
+  }
+
+  file = calloc(1,sizeof(struct watched_file));
+  file->wd = wd;
+  file->path = strdup(filename);
+  file->name = (slash == NULL) ? file->path : file->path + (slash - filename) + 1;
+
+  file->next = state->watched_files;
+  state->watched_files = file;
+
+  return 0;
+}
+
+int wiimoteglue_inotify_handle_event(struct wiimoteglue_state *state) {
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  struct watched_file *file;
+  int len;
+
+  /*Editors tend to touch a file several times per save.
+   *Drain everything queued up and reload each file once.
+   */
+  while ((len = read(state->inotify_fd,buf,sizeof(buf))) > 0) {
+    char *ptr = buf;
+    while (ptr < buf + len) {
+      struct inotify_event *ev = (struct inotify_event*)ptr;
+      ptr += sizeof(struct inotify_event) + ev->len;
+
+      if (ev->len == 0)
+        continue;
+
+      for (file = state->watched_files; file != NULL; file = file->next) {
+        if (file->wd == ev->wd && strcmp(file->name,ev->name) == 0)
+          file->changed = 1;
+      }
+    }
+  }
+
+  if (len < 0 && errno != EAGAIN) {
+    perror("inotify read");
+    return -1;
+  }
+
+  for (file = state->watched_files; *KEEP_LOOPING && file != NULL; file = file->next) {
+    if (!file->changed)
+      continue;
+
+    file->changed = 0;
+    printf("\nCommand file \'%s\' changed, reloading it.\n",file->path);
+    state->load_lines = 0;
+    wiimoteglue_load_command_file(state,file->path);
+  }
+
+  return 0;
+}
+
+int wiimoteglue_inotify_close(struct wiimoteglue_state *state) {
+  struct watched_file *file = state->watched_files;
+  while (file != NULL) {
+    struct watched_file *next = file->next;
+    free(file->path);
+    free(file);
+    file = next;
+  }
+  state->watched_files = NULL;
+
+  if (state->inotify_fd >= 0)
+    close(state->inotify_fd);
+  state->inotify_fd = -1;
+
+  return 0;
+}
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wiimoteglue.h"
+
+/* Two-dot sensor bar tracking, used by "ir multiple".
+ *
+ * The pointer is the midpoint of the two sensor bar dots,
+ * rotated to undo any roll of the wiimote, which we know
+ * from the angle between the dots. When one dot leaves the
+ * camera's view, the last known spacing between the dots
+ * fills in for it, and the accelerometer (if it's on)
+ * fills in for the roll.
+ *
+ * Optionally, the pointer can be led a little ahead along
+ * its current velocity, which hides some of the camera's lag.
+ *
+ * Everything here is integer math.
+ */
+
+#define IR_CENTER_X 512
+#define IR_CENTER_Y 380
+#define IR_PREDICT_US 30000 /*how far ahead to lead the pointer*/
+#define IR_MAX_GAP_US 100000 /*don't predict across longer gaps*/
+
+static int ir_valid(struct xwii_event_abs *dot) {
+  return dot->x != 1023 && dot->y != 1023 && dot->x > 1;
+}
+
+static int isqrt(long long n) {
+  if (n <= 0)
+    return 0;
+  long long x = n;
+  long long y = (x + 1) / 2;
+  while (y < x) {
+    x = y;
+    y = (x + n / x) / 2;
+  }
+  return (int) x;
+}
+
+/*Rotate (x,y) by the inverse of the angle of (rx,ry).*/
+static void unrotate(int *x, int *y, int rx, int ry) {
+  int len = isqrt((long long)rx*rx + (long long)ry*ry);
+  if (len == 0)
+    return;
+  long long nx = ((long long)*x * rx + (long long)*y * ry) / len;
+  long long ny = ((long long)*y * rx - (long long)*x * ry) / len;
+  *x = (int) nx;
+  *y = (int) ny;
+}
+
+/*Pick the two dots most like the sensor bar: the pair
+ *closest to how it looked last time, or failing that,
+ *the most level pair.
+ */
+static int ir_pick_pair(struct ir_tracker *ir, struct xwii_event_abs *dots[], int num, int *left, int *right) {
+  long long best = -1;
+  int i, j;
+  for (i = 0; i < num; i++) {
+    for (j = i + 1; j < num; j++) {
+      int a = (dots[i]->x <= dots[j]->x) ? i : j;
+      int b = (a == i) ? j : i;
+      int sx = dots[b]->x - dots[a]->x;
+      int sy = dots[b]->y - dots[a]->y;
+      long long score;
+      if (ir->have_pair) {
+        score = (long long)(sx - ir->sep_x)*(sx - ir->sep_x)
+          + (long long)(sy - ir->sep_y)*(sy - ir->sep_y);
+      } else {
+        score = (long long)abs(sy) * 1024 / (sx + 1);
+      }
+      if (best < 0 || score < best) {
+        best = score;
+        *left = a;
+        *right = b;
+      }
+    }
+  }
+  return best >= 0;
+}
+
+/*Returns 1 if the pointer was updated, 0 if the sensor bar is out of sight.*/
+int ir_track(struct ir_tracker *ir, struct xwii_event_abs *dots, struct motion_fusion *motion, struct timeval *time, int predict) {
+  struct xwii_event_abs *seen[4];
+  int num = 0;
+  int i;
+  for (i = 0; i < 4; i++) {
+    if (ir_valid(&dots[i]))
+      seen[num++] = &dots[i];
+  }
+
+  if (num == 0) {
+    ir->have_pos = 0;
+    return 0;
+  }
+
+  /*Roll from the accelerometer: gravity across the wiimote
+   *turns the camera image the same way the dots turn.
+   */
+  int have_accel = motion->have_accel;
+  int ax = motion->accel[0];
+  int az = motion->accel[2];
+  if (ir->accel_sign == 0)
+    ir->accel_sign = 1;
+
+  int rx, ry;
+  if (num >= 2) {
+    int l, r;
+    ir_pick_pair(ir,seen,num,&l,&r);
+    ir->sep_x = seen[r]->x - seen[l]->x;
+    ir->sep_y = seen[r]->y - seen[l]->y;
+    ir->mid_x = (seen[l]->x + seen[r]->x) / 2;
+    ir->mid_y = (seen[l]->y + seen[r]->y) / 2;
+    ir->have_pair = 1;
+    rx = ir->sep_x;
+    ry = ir->sep_y;
+
+    /*While both dots are visible, learn which way the
+     *accelerometer's roll relates to the dots' angle.
+     *Only bother when both clearly show some roll.
+     */
+    int sep = isqrt((long long)rx*rx + (long long)ry*ry);
+    int g = isqrt((long long)ax*ax + (long long)az*az);
+    if (have_accel && abs(ry)*8 > sep && abs(ax)*8 > g)
+      ir->accel_sign = ((ry > 0) == (ax > 0)) ? 1 : -1;
+  } else if (ir->have_pair) {
+    /*One dot. Whichever end of the bar it's nearer to,
+     *put the midpoint half a bar's length away.
+     */
+    int hx = ir->sep_x / 2;
+    int hy = ir->sep_y / 2;
+    long long to_left = (long long)(seen[0]->x - (ir->mid_x - hx))*(seen[0]->x - (ir->mid_x - hx))
+      + (long long)(seen[0]->y - (ir->mid_y - hy))*(seen[0]->y - (ir->mid_y - hy));
+    long long to_right = (long long)(seen[0]->x - (ir->mid_x + hx))*(seen[0]->x - (ir->mid_x + hx))
+      + (long long)(seen[0]->y - (ir->mid_y + hy))*(seen[0]->y - (ir->mid_y + hy));
+    if (to_left <= to_right) {
+      ir->mid_x = seen[0]->x + hx;
+      ir->mid_y = seen[0]->y + hy;
+    } else {
+      ir->mid_x = seen[0]->x - hx;
+      ir->mid_y = seen[0]->y - hy;
+    }
+    rx = ir->sep_x;
+    ry = ir->sep_y;
+    if (have_accel && (ax != 0 || az != 0)) {
+      rx = az;
+      ry = ir->accel_sign * ax;
+    }
+  } else {
+    /*Never seen both dots; the best we can do.*/
+    ir->mid_x = seen[0]->x;
+    ir->mid_y = seen[0]->y;
+    rx = 1;
+    ry = 0;
+    if (have_accel && (ax != 0 || az != 0)) {
+      rx = az;
+      ry = ir->accel_sign * ax;
+    }
+  }
+
+  int len = isqrt((long long)rx*rx + (long long)ry*ry);
+  ir->roll = (len > 0) ? ry * 1024 / len : 0;
+  ir->dist = isqrt((long long)ir->sep_x*ir->sep_x + (long long)ir->sep_y*ir->sep_y);
+
+  int x = (ir->mid_x - IR_CENTER_X) * 16;
+  int y = (ir->mid_y - IR_CENTER_Y) * 16;
+  unrotate(&x,&y,rx,ry);
+
+  long long dt = (long long)(time->tv_sec - ir->last.tv_sec) * 1000000
+    + (time->tv_usec - ir->last.tv_usec);
+  ir->last = *time;
+
+  if (ir->have_pos && dt > 0 && dt < IR_MAX_GAP_US) {
+    int vx = (int)((long long)(x - ir->pos_x) * 1000000 / dt);
+    int vy = (int)((long long)(y - ir->pos_y) * 1000000 / dt);
+    ir->vel_x += (vx - ir->vel_x) / 4;
+    ir->vel_y += (vy - ir->vel_y) / 4;
+  } else {
+    ir->vel_x = 0;
+    ir->vel_y = 0;
+  }
+  ir->pos_x = x;
+  ir->pos_y = y;
+  ir->have_pos = 1;
+
+  if (predict) {
+    x += (int)((long long)ir->vel_x * IR_PREDICT_US / 1000000);
+    y += (int)((long long)ir->vel_y * IR_PREDICT_US / 1000000);
+  }
+
+  ir->out_x = x;
+  ir->out_y = y;
+  return 1;
+}
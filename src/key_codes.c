@@ -11,7 +11,7 @@
  *It will make a brand new version of this entire file.
  */
 
-int * get_input_key(char *key_name, int button_map[]) {
+int16_t * get_input_key(char *key_name, int16_t button_map[]) {
   if (key_name == NULL) return NULL;
   if (strcmp(key_name,"up") == 0) return &button_map[XWII_KEY_UP];
   if (strcmp(key_name,"down") == 0) return &button_map[XWII_KEY_DOWN];
@@ -37,7 +37,7 @@ int * get_input_key(char *key_name, int button_map[]) {
   return NULL;
 }
 
-int * get_input_axis(char *axis_name, struct event_map *map) {
+int16_t * get_input_axis(char *axis_name, struct event_map *map) {
   if (axis_name == NULL) return NULL;
   if (strcmp(axis_name,"accelx") == 0) return map->accel_map[0];
   if (strcmp(axis_name,"accely") == 0) return map->accel_map[1];
@@ -51,14 +51,25 @@ int * get_input_axis(char *axis_name, struct event_map *map) {
   if (strcmp(axis_name,"right_y") == 0) return map->stick_map[3];
   if (strcmp(axis_name,"n_x") == 0) return map->stick_map[4];
   if (strcmp(axis_name,"n_y") == 0) return map->stick_map[5];
+  if (strcmp(axis_name,"l_trigger") == 0) return map->stick_map[6];
+  if (strcmp(axis_name,"r_trigger") == 0) return map->stick_map[7];
   if (strcmp(axis_name,"ir_x") == 0) return map->IR_map[0];
   if (strcmp(axis_name,"ir_y") == 0) return map->IR_map[1];
+  if (strcmp(axis_name,"ir_dist") == 0) return map->IR_map[2];
+  if (strcmp(axis_name,"ir_roll") == 0) return map->IR_map[3];
   if (strcmp(axis_name,"bal_fl") == 0) return map->balance_map[0];
   if (strcmp(axis_name,"bal_fr") == 0) return map->balance_map[1];
   if (strcmp(axis_name,"bal_bl") == 0) return map->balance_map[2];
   if (strcmp(axis_name,"bal_br") == 0) return map->balance_map[3];
   if (strcmp(axis_name,"bal_x") == 0) return map->balance_map[4];
   if (strcmp(axis_name,"bal_y") == 0) return map->balance_map[5];
+  if (strcmp(axis_name,"bal_weight") == 0) return map->balance_map[6];
+  if (strcmp(axis_name,"gyro_x") == 0) return map->gyro_map[0];
+  if (strcmp(axis_name,"gyro_y") == 0) return map->gyro_map[1];
+  if (strcmp(axis_name,"gyro_z") == 0) return map->gyro_map[2];
+  if (strcmp(axis_name,"pitch") == 0) return map->gyro_map[3];
+  if (strcmp(axis_name,"roll") == 0) return map->gyro_map[4];
+  if (strcmp(axis_name,"yaw") == 0) return map->gyro_map[5];
 
   return NULL;
 }
@@ -520,8 +531,14 @@ int get_output_axis(char *axis_name) {
   if (strcmp(axis_name,"left_y") == 0) return ABS_Y;
   if (strcmp(axis_name,"right_x") == 0) return ABS_RX;
   if (strcmp(axis_name,"right_y") == 0) return ABS_RY;
+  if (strcmp(axis_name,"left_trigger") == 0) return ABS_Z;
+  if (strcmp(axis_name,"right_trigger") == 0) return ABS_RZ;
   if (strcmp(axis_name,"mouse_x") == 0) return ABS_X;
   if (strcmp(axis_name,"mouse_y") == 0) return ABS_Y;
+  if (strcmp(axis_name,"rel_x") == 0) return WG_REL_AXIS | REL_X;
+  if (strcmp(axis_name,"rel_y") == 0) return WG_REL_AXIS | REL_Y;
+  if (strcmp(axis_name,"wheel") == 0) return WG_REL_AXIS | REL_WHEEL;
+  if (strcmp(axis_name,"hwheel") == 0) return WG_REL_AXIS | REL_HWHEEL;
   if (strcmp(axis_name,"none") == 0) return NO_MAP;
 
   return -2;
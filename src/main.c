@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -35,6 +36,13 @@ struct commandline_options {
   int monitor_for_new_wiimotes;
   int ignore_pro;
   int no_set_leds;
+  int no_watch_files;
+  int realtime_priority;
+  int busy_poll_us;
+  int busy_poll_budget;
+  char* cpus;
+  int slot_policy;
+  char* registry_path;
   char* virt_gamepad_name;
   char* virt_keyboardmouse_name;
   char* uinput_path;
@@ -56,6 +64,8 @@ int main(int argc, char *argv[]) {
   options.number_of_slots = -1; /*initialize so we know it has been set*/
   options.monitor_for_new_wiimotes = 1; /*sensible default values*/
   options.check_for_existing_wiimotes = 1;
+  options.registry_path = "wiimoteglue.devices";
+  options.busy_poll_budget = BUSY_POLL_DEFAULT_BUDGET;
   ret = handle_arguments(&options, argc, argv);
   if (ret == 1) {
     return 0; /*arguments just said to print out help or version info.*/
@@ -112,6 +122,8 @@ int main(int argc, char *argv[]) {
   }
 
   state.virtual_keyboardmouse_fd = state.slots[0].uinput_fd;
+  state.slot_alloc.policy = options.slot_policy;
+  slot_allocator_init(&state);
 
   state.head_map.next = &state.head_map;
   state.head_map.prev = &state.head_map;
@@ -143,13 +155,39 @@ int main(int argc, char *argv[]) {
   printf("KB name: %s\n",keymouse->maps.name);
 
 
-  wiimoteglue_epoll_init(&epfd);
+  if (wiimoteglue_epoll_init(&state, &epfd) < 0) {
+    printf("Could not start the event loop, aborting.\n");
+    wiimoteglue_uinput_close(state.num_slots,state.slots);
+    return -1;
+  }
   if (options.monitor_for_new_wiimotes)
-    wiimoteglue_epoll_watch_monitor(epfd, monitor_fd, state.monitor);
+    wiimoteglue_epoll_watch_monitor(&state, epfd, monitor_fd, state.monitor);
 
   wiimoteglue_epoll_watch_stdin(&state, epfd);
 
+  state.inotify_fd = -1;
+  if (!options.no_watch_files) {
+    ret = wiimoteglue_inotify_init(&state.inotify_fd);
+    if (ret) {
+      printf("Could not watch for changes to command files. They won't be reloaded automatically.\n");
+    } else {
+      wiimoteglue_epoll_watch_inotify(&state, epfd);
+    }
+  }
+
+  if (wiimoteglue_timers_init(&state) == 0) {
+    wiimoteglue_epoll_watch_timers(&state, epfd);
+  } else {
+    printf("Could not create a timer. Relative mouse axes, turbo buttons, and macros won't work.\n");
+  }
+  wiimoteglue_mouse_init(&state);
+
   state.epfd = epfd;
+  state.busy_poll.window = options.busy_poll_us * 1000ULL;
+  state.busy_poll.budget = options.busy_poll_budget;
+  if (options.busy_poll_us > 0)
+    printf("Busy-polling for %dus after each event (at most %d%% of a CPU).\n",
+           options.busy_poll_us, options.busy_poll_budget);
 
 
   //Start forwarding input events.
@@ -162,6 +200,8 @@ int main(int argc, char *argv[]) {
   signal(SIGINT, signal_handler);
   signal(SIGTERM, signal_handler);
   signal(SIGHUP, signal_handler);
+  wiimoteglue_registry_load(&state,options.registry_path);
+
   if (options.file_to_load != NULL) {
     printf("\n");
     wiimoteglue_load_command_file(&state,options.file_to_load);
@@ -182,6 +222,11 @@ int main(int argc, char *argv[]) {
     printf("\nWiimoteGlue is now running and waiting for Wiimotes.\n");
   printf("Enter \"help\" for available commands.\n>>");
   fflush(stdout);
+
+  /*Last, so everything the loop uses is already in memory.*/
+  if (options.realtime_priority > 0 || options.cpus != NULL)
+    wiimoteglue_realtime_init(&state, options.realtime_priority, options.cpus);
+
   wiimoteglue_epoll_loop(epfd, &state);
 
 
@@ -203,17 +248,20 @@ int main(int argc, char *argv[]) {
     list_node = next;
   }
 
-  struct map_list *mlist_node;
-  mlist_node = state.head_map.next;
-  while (mlist_node != NULL && mlist_node != &state.head_map) {
-    struct map_list *next = mlist_node->next;
-    free(mlist_node->maps.name);
-    free(mlist_node);
-    mlist_node = next;
-  }
+  device_table_close(&state);
 
+  mappings_close(&state);
 
 
+
+  wiimoteglue_mouse_close(&state);
+  wiimoteglue_timers_close(&state);
+  wiimoteglue_epoll_close(&state, epfd);
+  macros_free();
+  response_curves_free();
+  wiimoteglue_inotify_close(&state);
+  wiimoteglue_registry_close(&state);
+
   wiimoteglue_uinput_close(state.num_slots, state.slots);
 
   free(state.slots);
@@ -248,6 +296,14 @@ int handle_arguments(struct commandline_options *options, int argc, char *argv[]
      printf("      --no-monitor\t\tDon't listen for new devices.\n");
      printf("      --ignore-pro\t\tIgnore Wii U Pro controllers\n");
      printf("      --no-set-leds\t\tDon't change controller LEDS\n");
+     printf("      --slot-policy <policy>\tHow new devices pick a slot: sticky, lowest, or round-robin\n");
+     printf("      --no-watch\t\tDon't reload command files when they change\n");
+     printf("      --registry <file>\t\tWhere to remember devices (default wiimoteglue.devices)\n");
+     printf("      --no-registry\t\tDon't remember devices between runs\n");
+     printf("      --realtime [priority]\tRun SCHED_FIFO (default priority %d) with memory locked\n",RT_DEFAULT_PRIORITY);
+     printf("      --cpus <list>\t\tOnly run on these CPUs (like 3 or 2,3 or 0-1)\n");
+     printf("      --busy-poll <us>\t\tSpin instead of sleeping for this long after each event\n");
+     printf("      --busy-poll-budget <percent>\tMost of a CPU to spend spinning (default %d)\n",BUSY_POLL_DEFAULT_BUDGET);
      return 1;
    }
    if (strcmp("--version",argv[0]) == 0 || strcmp("-v",argv[0]) == 0) {
@@ -292,11 +348,11 @@ int handle_arguments(struct commandline_options *options, int argc, char *argv[]
        return -1;
      }
 
-     int num = argv[1][0] - '0'; /*HACK bad atoi*/
+     char *end;
+     long num = strtol(argv[1],&end,10);
 
-
-     if (num < 0 || num > 9 || argv[1][0] == '\0' || argv[1][1] != '\0') {
-       printf("Number of gamepad slots %d must be in range 0 to 9\n",num);
+     if (num < 0 || num > MAX_SLOTS || argv[1][0] == '\0' || *end != '\0') {
+       printf("Number of gamepad slots %s must be in range 0 to %d\n",argv[1],MAX_SLOTS);
        return -1;
      }
 
@@ -306,8 +362,88 @@ int handle_arguments(struct commandline_options *options, int argc, char *argv[]
      argv++;
    } else if (strcmp("--ignore-pro",argv[0]) == 0) {
      options->ignore_pro = 1;
+   } else if (strcmp("--slot-policy",argv[0]) == 0) {
+     if (argc < 2) {
+       printf("Argument \"%s\" requires a policy.\n",argv[0]);
+       return -1;
+     }
+
+     options->slot_policy = slot_policy_lookup(argv[1]);
+     if (options->slot_policy < 0) {
+       printf("Slot policy \"%s\" not recognized (sticky, lowest, or round-robin)\n",argv[1]);
+       return -1;
+     }
+
+     argc--;
+     argv++;
    } else if (strcmp("--no-set-leds",argv[0]) == 0) {
      options->no_set_leds = 1;
+   } else if (strcmp("--registry",argv[0]) == 0) {
+     if (argc < 2) {
+       printf("Argument \"%s\" requires a filename.\n",argv[0]);
+       return -1;
+     }
+
+     options->registry_path = argv[1];
+
+     argc--;
+     argv++;
+   } else if (strcmp("--realtime",argv[0]) == 0) {
+     options->realtime_priority = RT_DEFAULT_PRIORITY;
+     if (argc >= 2 && isdigit(argv[1][0])) {
+       char *end;
+       long priority = strtol(argv[1],&end,10);
+       if (*end != '\0' || priority < 1 || priority > 99) {
+         printf("Real-time priority %s must be in range 1 to 99\n",argv[1]);
+         return -1;
+       }
+       options->realtime_priority = priority;
+       argc--;
+       argv++;
+     }
+   } else if (strcmp("--busy-poll",argv[0]) == 0 || strcmp("--busy-poll-budget",argv[0]) == 0) {
+     int budget = (strcmp("--busy-poll-budget",argv[0]) == 0);
+     if (argc < 2) {
+       printf("Argument \"%s\" requires a number.\n",argv[0]);
+       return -1;
+     }
+
+     char *end;
+     long num = strtol(argv[1],&end,10);
+     if (budget && (*end != '\0' || num < 1 || num > 100)) {
+       printf("Busy-poll budget %s must be in range 1 to 100\n",argv[1]);
+       return -1;
+     }
+     if (!budget && (*end != '\0' || num < 0 || num > 1000000)) {
+       printf("Busy-poll window %s must be in range 0 to 1000000 microseconds\n",argv[1]);
+       return -1;
+     }
+
+     if (budget)
+       options->busy_poll_budget = num;
+     else
+       options->busy_poll_us = num;
+
+     argc--;
+     argv++;
+   } else if (strcmp("--cpus",argv[0]) == 0) {
+     if (argc < 2) {
+       printf("Argument \"%s\" requires a list of CPUs.\n",argv[0]);
+       return -1;
+     }
+
+     if (realtime_check_cpus(argv[1]) < 0) {
+       printf("CPU list \"%s\" not recognized.\n",argv[1]);
+       return -1;
+     }
+     options->cpus = argv[1];
+
+     argc--;
+     argv++;
+   } else if (strcmp("--no-registry",argv[0]) == 0) {
+     options->registry_path = NULL;
+   } else if (strcmp("--no-watch",argv[0]) == 0) {
+     options->no_watch_files = 1;
    } else if (strcmp("--no-enumerate",argv[0]) == 0) {
      options->check_for_existing_wiimotes = 0;
    } else if (strcmp("--no-monitor",argv[0]) == 0) {
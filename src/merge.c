@@ -0,0 +1,287 @@
+#include <linux/input.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "wiimoteglue.h"
+
+/* Merging the output of every device in a slot.
+ *
+ * Each device in a slot gets a bit of its own, and
+ * everything it sends out comes through here first.
+ * A button is held for as long as any device holds it.
+ * An axis, or a mouse velocity, is combined from every
+ * device's latest value by the slot's policy:
+ *   last - whichever device moved it most recently
+ *   max - whichever device is pushing it furthest
+ *   sum - all of them added up, clamped to the axis range
+ *
+ * Only changes to the combined outputs are queued,
+ * and the queue goes out as one frame, ending in a
+ * single SYN, when the device finishes its event.
+ */
+
+static uint32_t merge_bit(struct wii_device *dev) {
+  if (dev->merge_index < 0)
+    return 0;
+  return 1u << dev->merge_index;
+}
+
+static void merge_queue(struct virtual_controller *slot, int type, int code, int value) {
+  struct output_merge *merge = &slot->merge;
+  if (merge->frame_len >= MERGE_FRAME_SIZE - 1)
+    slot_merge_flush(slot);
+
+  struct input_event *out = &merge->frame[merge->frame_len++];
+  memset(out,0,sizeof(*out));
+  out->type = type;
+  out->code = code;
+  out->value = value;
+}
+
+void slot_merge_flush(struct virtual_controller *slot) {
+  struct output_merge *merge = &slot->merge;
+  if (merge->frame_len == 0)
+    return;
+
+  struct input_event *syn = &merge->frame[merge->frame_len++];
+  memset(syn,0,sizeof(*syn));
+  syn->type = EV_SYN;
+  syn->code = SYN_REPORT;
+
+  write(slot->uinput_fd, merge->frame, merge->frame_len * sizeof(struct input_event));
+  merge->frame_len = 0;
+}
+
+void slot_merge_key(struct wii_device *dev, int code, int value) {
+  struct virtual_controller *slot = dev->slot;
+  uint32_t bit = merge_bit(dev);
+  if (slot == NULL)
+    return;
+
+  /*Devices past the limit, and codes we
+   *don't track, just go straight through.
+   */
+  if (bit == 0 || code < 0 || code >= MAX_OUTPUT_KEY) {
+    merge_queue(slot, EV_KEY, code, value);
+    return;
+  }
+
+  uint32_t *holders = &slot->merge.key_holders[code];
+  if (value == 2) {
+    /*Auto-repeat, from a device actually holding it.*/
+    if (*holders & bit)
+      merge_queue(slot, EV_KEY, code, 2);
+    return;
+  }
+
+  uint32_t before = *holders;
+  if (value)
+    *holders |= bit;
+  else
+    *holders &= ~bit;
+
+  if ((before != 0) != (*holders != 0))
+    merge_queue(slot, EV_KEY, code, *holders != 0);
+}
+
+static int merge_values(int *values, uint32_t writers, int policy, int latest) {
+  int i;
+
+  if (policy == MERGE_LAST)
+    return latest;
+
+  if (policy == MERGE_SUM) {
+    int sum = 0;
+    for (i = 0; writers != 0; i++, writers >>= 1) {
+      if (writers & 1)
+        sum += values[i];
+    }
+    if (sum > ABS_LIMIT)
+      sum = ABS_LIMIT;
+    if (sum < -ABS_LIMIT - 1)
+      sum = -ABS_LIMIT - 1;
+    return sum;
+  }
+
+  int best = 0;
+  for (i = 0; writers != 0; i++, writers >>= 1) {
+    if ((writers & 1) && abs(values[i]) > abs(best))
+      best = values[i];
+  }
+  return best;
+}
+
+static int merge_combine(struct output_merge *merge, int policy, int code, int latest) {
+  return merge_values(merge->abs_values[code], merge->abs_writers[code], policy, latest);
+}
+
+static void merge_abs_out(struct virtual_controller *slot, int code, int out) {
+  struct output_merge *merge = &slot->merge;
+  int i;
+  if (out == merge->abs_out[code])
+    return;
+  merge->abs_out[code] = out;
+
+  /*One value per axis per frame.*/
+  for (i = 0; i < merge->frame_len; i++) {
+    if (merge->frame[i].type == EV_ABS && merge->frame[i].code == code) {
+      merge->frame[i].value = out;
+      return;
+    }
+  }
+  merge_queue(slot, EV_ABS, code, out);
+}
+
+void slot_merge_abs(struct wii_device *dev, int code, int value) {
+  struct virtual_controller *slot = dev->slot;
+  struct output_merge *merge;
+  uint32_t bit = merge_bit(dev);
+  if (slot == NULL)
+    return;
+
+  if (bit == 0 || code < 0 || code >= MAX_OUTPUT_ABS) {
+    merge_queue(slot, EV_ABS, code, value);
+    return;
+  }
+
+  merge = &slot->merge;
+  int changed = (merge->abs_values[code][dev->merge_index] != value);
+  merge->abs_values[code][dev->merge_index] = value;
+  if (value != 0)
+    merge->abs_writers[code] |= bit;
+  else
+    merge->abs_writers[code] &= ~bit;
+
+  /*Axes are reported over and over whether they moved
+   *or not. For "last", only a device whose value actually
+   *changed takes the axis; the rest leave the output alone.
+   */
+  if (merge->policy == MERGE_LAST && !changed)
+    return;
+
+  merge_abs_out(slot, code, merge_combine(merge, merge->policy, code, value));
+}
+
+/*Mouse velocities aren't sent as they come, the mouse
+ *timer moves the pointer, so this just works out the
+ *slot's combined velocity for the axis and returns it.
+ */
+int slot_merge_rel(struct wii_device *dev, int rel, int value) {
+  struct virtual_controller *slot = dev->slot;
+  struct output_merge *merge = &slot->merge;
+  uint32_t bit = merge_bit(dev);
+  if (bit == 0)
+    return value;
+
+  int changed = (merge->rel_values[rel][dev->merge_index] != value);
+  merge->rel_values[rel][dev->merge_index] = value;
+  if (value != 0)
+    merge->rel_writers[rel] |= bit;
+  else
+    merge->rel_writers[rel] &= ~bit;
+
+  if (merge->policy == MERGE_LAST && !changed)
+    return slot->rel_velocity[rel];
+
+  return merge_values(merge->rel_values[rel], merge->rel_writers[rel], merge->policy, value);
+}
+
+/*Give a device joining the slot a bit of its own.
+ *Past MAX_SLOT_DEVICES, devices go unmerged.
+ */
+void slot_merge_join(struct virtual_controller *slot, struct wii_device *dev) {
+  int i;
+  dev->merge_index = -1;
+  for (i = 0; i < MAX_SLOT_DEVICES; i++) {
+    if (!(slot->merge.members & (1u << i))) {
+      slot->merge.members |= 1u << i;
+      dev->merge_index = i;
+      return;
+    }
+  }
+}
+
+/*Take back whatever a device leaving the slot was
+ *contributing: buttons only it held are released, and
+ *axes and mouse motion fall back to the other devices
+ *(or to center). It all goes out as a single frame.
+ */
+void slot_merge_leave(struct wii_device *dev) {
+  struct virtual_controller *slot = dev->slot;
+  struct output_merge *merge = &slot->merge;
+  uint32_t bit = merge_bit(dev);
+  int i;
+
+  if (bit != 0) {
+    for (i = 0; i < MAX_OUTPUT_KEY; i++) {
+      if (merge->key_holders[i] & bit)
+        slot_merge_key(dev, i, 0);
+    }
+    /*Nobody is the last writer now, so
+     *"last" falls back to the furthest.
+     */
+    int policy = (merge->policy == MERGE_LAST) ? MERGE_MAX : merge->policy;
+    for (i = 0; i < MAX_OUTPUT_ABS; i++) {
+      if (!(merge->abs_writers[i] & bit))
+        continue;
+      merge->abs_writers[i] &= ~bit;
+      merge->abs_values[i][dev->merge_index] = 0;
+      merge_abs_out(slot, i, merge_combine(merge, policy, i, 0));
+    }
+    for (i = 0; i < WG_REL_NUM; i++) {
+      if (!(merge->rel_writers[i] & bit))
+        continue;
+      merge->rel_writers[i] &= ~bit;
+      merge->rel_values[i][dev->merge_index] = 0;
+      slot->rel_velocity[i] = merge_values(merge->rel_values[i], merge->rel_writers[i], policy, 0);
+    }
+    merge->members &= ~bit;
+  }
+
+  slot_merge_flush(slot);
+  dev->merge_index = -1;
+}
+
+/*Let go of everything on the slot's current virtual
+ *device, before it switches to another one.
+ */
+void slot_merge_clear(struct virtual_controller *slot) {
+  struct output_merge *merge = &slot->merge;
+  int i;
+
+  for (i = 0; i < MAX_OUTPUT_KEY; i++) {
+    if (merge->key_holders[i])
+      merge_queue(slot, EV_KEY, i, 0);
+    merge->key_holders[i] = 0;
+  }
+  for (i = 0; i < MAX_OUTPUT_ABS; i++) {
+    if (merge->abs_out[i])
+      merge_queue(slot, EV_ABS, i, 0);
+    merge->abs_out[i] = 0;
+    merge->abs_writers[i] = 0;
+  }
+  memset(merge->abs_values,0,sizeof(merge->abs_values));
+  slot_merge_flush(slot);
+}
+
+char* merge_policy_name(int policy) {
+  switch (policy) {
+  case MERGE_LAST: return "last";
+  case MERGE_SUM: return "sum";
+  default: return "max";
+  }
+}
+
+int merge_policy_lookup(char *name) {
+  if (name == NULL)
+    return -1;
+  if (strcmp(name,"last") == 0)
+    return MERGE_LAST;
+  if (strcmp(name,"max") == 0)
+    return MERGE_MAX;
+  if (strcmp(name,"sum") == 0)
+    return MERGE_SUM;
+  return -1;
+}
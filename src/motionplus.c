@@ -0,0 +1,116 @@
+#include <math.h>
+#include <string.h>
+
+#include "wiimoteglue.h"
+
+/* Motion Plus gyro rates, and fusing them with the
+ * accelerometer into an orientation (pitch/roll/yaw).
+ *
+ * The fusion is a complementary filter stepped at a fixed
+ * rate, so it behaves the same no matter how often or how
+ * unevenly the wiimote reports. Integrating the gyro gives
+ * a quick, smooth orientation that slowly drifts; gravity,
+ * as seen by the accelerometer, pulls pitch and roll back.
+ * Nothing can correct yaw, so expect it to wander a bit.
+ *
+ * All state lives in the wii_device; nothing is allocated.
+ */
+
+#define FUSION_STEP 0.005f /*seconds*/
+#define FUSION_MAX_GAP 0.1f /*longer gaps restart integration*/
+#define FUSION_TAU 0.5f /*seconds for the accelerometer to pull us back*/
+
+/*While the gyro reads less than this, assume it is
+ *sitting still and slowly learn its zero offset.
+ */
+#define BIAS_THRESHOLD (MP_UNITS_PER_DEGREE*10)
+#define BIAS_RATE (1/128.0f)
+
+void motionplus_reset(struct motion_fusion *fusion) {
+  memset(fusion,0,sizeof(*fusion));
+}
+
+void motionplus_accel(struct motion_fusion *fusion, struct xwii_event_abs *accel) {
+  fusion->accel[0] = accel[0].x;
+  fusion->accel[1] = accel[0].y;
+  fusion->accel[2] = accel[0].z;
+  fusion->have_accel = 1;
+}
+
+void motionplus_rates(struct motion_fusion *fusion, struct xwii_event_abs *gyro) {
+  float raw[3] = {gyro[0].x, gyro[0].y, gyro[0].z};
+  int still = 1;
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    if (fabsf(raw[i] - fusion->bias[i]) > BIAS_THRESHOLD)
+      still = 0;
+  }
+
+  for (i = 0; i < 3; i++) {
+    if (still)
+      fusion->bias[i] += (raw[i] - fusion->bias[i]) * BIAS_RATE;
+    fusion->rate[i] = (raw[i] - fusion->bias[i]) / MP_UNITS_PER_DEGREE;
+  }
+}
+
+static float wrap_degrees(float angle) {
+  while (angle >= 180)
+    angle -= 360;
+  while (angle < -180)
+    angle += 360;
+  return angle;
+}
+
+void motionplus_fuse(struct motion_fusion *fusion, struct timeval *time) {
+  float dt = 0;
+  if (fusion->last.tv_sec != 0 || fusion->last.tv_usec != 0) {
+    dt = (time->tv_sec - fusion->last.tv_sec)
+      + (time->tv_usec - fusion->last.tv_usec) / 1000000.0f;
+  }
+  fusion->last = *time;
+
+  if (dt < 0 || dt > FUSION_MAX_GAP)
+    dt = 0; /*clock jumped, or we weren't listening*/
+  fusion->pending += dt;
+
+  /*Only trust gravity when the wiimote isn't
+   *being swung around much.
+   */
+  int use_accel = 0;
+  float accel_pitch = 0;
+  float accel_roll = 0;
+  if (fusion->have_accel) {
+    float x = fusion->accel[0];
+    float y = fusion->accel[1];
+    float z = fusion->accel[2];
+    float mag = x*x + y*y + z*z;
+    if (mag > (0.8f*ACCEL_1G)*(0.8f*ACCEL_1G) && mag < (1.2f*ACCEL_1G)*(1.2f*ACCEL_1G)) {
+      use_accel = 1;
+      accel_pitch = atan2f(y, z) * (180 / M_PI);
+      accel_roll = atan2f(-x, z) * (180 / M_PI);
+    }
+  }
+
+  float blend = FUSION_STEP / (FUSION_TAU + FUSION_STEP);
+
+  /*gyro x, y, z are the pitch, roll, and yaw rates
+   *with the wiimote held pointing at the screen.
+   */
+  while (fusion->pending >= FUSION_STEP) {
+    fusion->pitch += fusion->rate[0] * FUSION_STEP;
+    fusion->roll += fusion->rate[1] * FUSION_STEP;
+    fusion->yaw += fusion->rate[2] * FUSION_STEP;
+
+    if (use_accel) {
+      fusion->pitch += blend * wrap_degrees(accel_pitch - fusion->pitch);
+      fusion->roll += blend * wrap_degrees(accel_roll - fusion->roll);
+    }
+
+    fusion->pending -= FUSION_STEP;
+  }
+
+  fusion->pitch = wrap_degrees(fusion->pitch);
+  fusion->roll = wrap_degrees(fusion->roll);
+  fusion->yaw = wrap_degrees(fusion->yaw);
+}
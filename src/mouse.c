@@ -0,0 +1,226 @@
+#include <linux/input.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "wiimoteglue.h"
+
+/* Relative mouse output.
+ *
+ * Input axes mapped to rel_x, rel_y, wheel, or hwheel
+ * set a velocity on their slot, combined with the other
+ * devices there like any other axis (see merge.c). A timer then moves the
+ * virtual mouse at a steady rate, no matter how often
+ * (or how unevenly) the controller reports.
+ * Fractions of a count are carried over to the next tick,
+ * so slow, fine movements aren't rounded away.
+ *
+ * The timer (on the timer wheel, see timers.c)
+ * only runs while something is moving.
+ */
+
+#define WHEEL_DETENT 120 /*hi-res wheel units per notch*/
+#define REL_FRACTION 65536
+#define MAX_CATCHUP_TICKS 4 /*don't jump the pointer after a stall*/
+#define NS_PER_SEC 1000000000ULL
+
+static int rel_codes[WG_REL_NUM] = {REL_X, REL_Y, REL_WHEEL, REL_HWHEEL};
+
+static void mouse_tick(struct wiimoteglue_state *state, struct wg_timer *timer);
+
+int wiimoteglue_mouse_init(struct wiimoteglue_state *state) {
+  /*Pointer speeds are in counts/second,
+   *the wheels in notches/second.
+   */
+  struct rel_curve pointer = {1500, 4096, 2.0f};
+  struct rel_curve wheel = {10, 8192, 1.0f};
+
+  state->rel_curves[WG_REL_X] = pointer;
+  state->rel_curves[WG_REL_Y] = pointer;
+  state->rel_curves[WG_REL_WHEEL] = wheel;
+  state->rel_curves[WG_REL_HWHEEL] = wheel;
+  state->mouse_rate = MOUSE_TICK_RATE;
+
+  memset(&state->mouse_tick,0,sizeof(state->mouse_tick));
+  state->mouse_tick.fire = mouse_tick;
+
+  return 0;
+}
+
+void mouse_set_velocity(struct wii_device *dev, int rel_code, int value) {
+  struct virtual_controller *slot = dev->slot;
+  int i;
+  for (i = 0; i < WG_REL_NUM; i++) {
+    if (rel_codes[i] == rel_code)
+      break;
+  }
+  if (i == WG_REL_NUM)
+    return;
+
+  slot->rel_velocity[i] = slot_merge_rel(dev, i, value);
+  if (slot->rel_velocity[i] != 0)
+    slot->rel_moving = 1;
+}
+
+void mouse_stop_slot(struct virtual_controller *slot) {
+  memset(slot->rel_velocity,0,sizeof(slot->rel_velocity));
+  memset(slot->merge.rel_values,0,sizeof(slot->merge.rel_values));
+  memset(slot->merge.rel_writers,0,sizeof(slot->merge.rel_writers));
+  memset(slot->rel_remainder,0,sizeof(slot->rel_remainder));
+  memset(slot->wheel_remainder,0,sizeof(slot->wheel_remainder));
+  slot->rel_moving = 0;
+}
+
+/*Signed speed, in counts/second, for an axis deflection.*/
+static float rel_speed(struct rel_curve *curve, int value) {
+  int mag = abs(value);
+  if (mag <= curve->deadzone)
+    return 0;
+
+  float norm = (mag - curve->deadzone) / (float)(ABS_LIMIT - curve->deadzone);
+  if (norm > 1)
+    norm = 1;
+
+  float speed = curve->speed * powf(norm, curve->exponent);
+  return (value < 0) ? -speed : speed;
+}
+
+static int slot_is_moving(struct wiimoteglue_state *state, struct virtual_controller *slot) {
+  int i;
+  for (i = 0; i < WG_REL_NUM; i++) {
+    if (abs(slot->rel_velocity[i]) > state->rel_curves[i].deadzone)
+      return 1;
+  }
+  return 0;
+}
+
+static int any_moving(struct wiimoteglue_state *state) {
+  int moving = 0;
+  int i;
+  for (i = 0; i <= state->num_slots; i++) {
+    state->slots[i].rel_moving = slot_is_moving(state,&state->slots[i]);
+    moving |= state->slots[i].rel_moving;
+  }
+  return moving;
+}
+
+int mouse_update_timer(struct wiimoteglue_state *state) {
+  if (!any_moving(state)) {
+    timer_cancel(&state->mouse_tick);
+    return 0;
+  }
+
+  if (timer_pending(&state->mouse_tick))
+    return 0;
+  return timer_start(&state->timers,&state->mouse_tick,NS_PER_SEC / state->mouse_rate);
+}
+
+int mouse_set_rate(struct wiimoteglue_state *state, int rate) {
+  if (rate < 10 || rate > 1000) {
+    printf("Mouse rate must be between 10 and 1000 Hz.\n");
+    return -1;
+  }
+
+  state->mouse_rate = rate;
+
+  /*Restart a running timer at the new interval.*/
+  timer_cancel(&state->mouse_tick);
+  return mouse_update_timer(state);
+}
+
+static void mouse_tick_slot(struct wiimoteglue_state *state, struct virtual_controller *slot, float dt) {
+  struct input_event out[2*WG_REL_NUM + 1];
+  int n = 0;
+  int i;
+
+  memset(out,0,sizeof(out));
+
+  for (i = 0; i < WG_REL_NUM; i++) {
+    float speed = rel_speed(&state->rel_curves[i],slot->rel_velocity[i]);
+    if (speed == 0) {
+      slot->rel_remainder[i] = 0;
+      continue;
+    }
+
+    if (i == WG_REL_WHEEL || i == WG_REL_HWHEEL)
+      speed *= WHEEL_DETENT;
+
+    slot->rel_remainder[i] += (int)(speed * dt * REL_FRACTION);
+    int counts = slot->rel_remainder[i] / REL_FRACTION;
+    slot->rel_remainder[i] -= counts * REL_FRACTION;
+
+    if (counts == 0)
+      continue;
+
+    if (i == WG_REL_X || i == WG_REL_Y) {
+      out[n].type = EV_REL;
+      out[n].code = rel_codes[i];
+      out[n].value = counts;
+      n++;
+      continue;
+    }
+
+    /*Wheels: smooth scrolling for those who understand it,
+     *whole notches for everyone else.
+     */
+#ifdef REL_WHEEL_HI_RES
+    out[n].type = EV_REL;
+    out[n].code = (i == WG_REL_WHEEL) ? REL_WHEEL_HI_RES : REL_HWHEEL_HI_RES;
+    out[n].value = counts;
+    n++;
+#endif
+    int *wheel = &slot->wheel_remainder[i - WG_REL_WHEEL];
+    *wheel += counts;
+    int detents = *wheel / WHEEL_DETENT;
+    *wheel -= detents * WHEEL_DETENT;
+    if (detents != 0) {
+      out[n].type = EV_REL;
+      out[n].code = rel_codes[i];
+      out[n].value = detents;
+      n++;
+    }
+  }
+
+  if (n == 0)
+    return;
+
+  out[n].type = EV_SYN;
+  out[n].code = SYN_REPORT;
+  out[n].value = 0;
+  n++;
+  write(slot->mouse_fd, out, n * sizeof(struct input_event));
+}
+
+static void mouse_tick(struct wiimoteglue_state *state, struct wg_timer *timer) {
+  uint64_t period = NS_PER_SEC / state->mouse_rate;
+  uint64_t now = state->timers.now;
+
+  /*Make up for ticks we were late for, within reason.*/
+  int ticks = 1;
+  uint64_t next = timer->expires + period;
+  while (next <= now && ticks < MAX_CATCHUP_TICKS) {
+    next += period;
+    ticks++;
+  }
+  if (next <= now)
+    next = now + period;
+
+  float dt = ticks / (float) state->mouse_rate;
+  int i;
+  for (i = 0; i <= state->num_slots; i++) {
+    if (state->slots[i].rel_moving)
+      mouse_tick_slot(state,&state->slots[i],dt);
+  }
+
+  /*Stops once everything is centered.*/
+  if (any_moving(state))
+    timer_schedule(&state->timers,timer,next);
+}
+
+int wiimoteglue_mouse_close(struct wiimoteglue_state *state) {
+  timer_cancel(&state->mouse_tick);
+  return 0;
+}
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wiimoteglue.h"
+
+/* Pools for the fixed-size things that come and go
+ * while running: mappings, their data, and so on.
+ *
+ * Objects are carved out of chunks, and freed objects go
+ * on a free list for the next allocation instead of back
+ * to malloc. Chunks are only released by pool_destroy(),
+ * so however often controllers and mappings come and go,
+ * memory use settles at the most that was ever needed,
+ * rather than fragmenting the heap. Allocating and freeing
+ * are a couple of pointer moves.
+ */
+
+#define POOL_ALIGN 16
+
+struct pool_chunk {
+  struct pool_chunk *next;
+};
+
+static size_t pool_item_size(struct pool *pool) {
+  size_t size = pool->size;
+  if (size < sizeof(void*))
+    size = sizeof(void*);
+  return (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+}
+
+/*Adds a chunk and puts all of its objects on the free list.*/
+static int pool_grow(struct pool *pool) {
+  size_t item = pool_item_size(pool);
+  struct pool_chunk *chunk = malloc(POOL_ALIGN + item * pool->per_chunk);
+  if (chunk == NULL)
+    return -1;
+
+  chunk->next = pool->chunks;
+  pool->chunks = chunk;
+
+  char *objects = (char*)chunk + POOL_ALIGN;
+  int i;
+  for (i = pool->per_chunk - 1; i >= 0; i--) {
+    void **object = (void**)(objects + i * item);
+    *object = pool->free_list;
+    pool->free_list = object;
+  }
+  return 0;
+}
+
+/*Returns a zeroed object, or NULL if out of memory.*/
+void* pool_alloc(struct pool *pool) {
+  if (pool->free_list == NULL && pool_grow(pool) < 0)
+    return NULL;
+
+  void **object = pool->free_list;
+  pool->free_list = *object;
+  memset(object,0,pool->size);
+  return object;
+}
+
+void pool_free(struct pool *pool, void *object) {
+  if (object == NULL)
+    return;
+  *(void**)object = pool->free_list;
+  pool->free_list = object;
+}
+
+/*Frees every chunk, and with them every object
+ *still allocated from the pool.
+ */
+void pool_destroy(struct pool *pool) {
+  struct pool_chunk *chunk = pool->chunks;
+  while (chunk != NULL) {
+    struct pool_chunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  pool->chunks = NULL;
+  pool->free_list = NULL;
+}
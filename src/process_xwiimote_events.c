@@ -13,15 +13,19 @@
  *
  */
 
+#define EXTENSION_SETTLE_MS 20 /*how long extension changes get to settle*/
+#define NS_PER_MS 1000000ULL
 
 
-void handle_key(int uinput_fd, int button_map[], struct xwii_event_key *ev);
-void handle_nunchuk(int uinput_fd, struct event_map *map, struct xwii_event_abs ev[]);
-void handle_classic(int uinput_fd, struct event_map *map, struct xwii_event_abs ev[]);
-void handle_pro(int uinput_fd, struct event_map *map, struct xwii_event_abs ev[]);
-void handle_accel(int uinput_fd, struct event_map *map, struct xwii_event_abs ev[]);
-void handle_IR(int uinput_fd, struct event_map *map, struct xwii_event_abs ev[]);
-void handle_balance(int uinput_fd, struct event_map *map, struct xwii_event_abs ev[]);
+
+void handle_key(struct wiimoteglue_state *state, struct wii_device *dev, struct event_map *map, struct xwii_event_key *ev);
+void handle_nunchuk(struct wii_device *dev, struct event_map *map, struct xwii_event_abs ev[], struct timeval *time);
+void handle_classic(struct wii_device *dev, struct event_map *map, struct xwii_event_abs ev[]);
+void handle_pro(struct wii_device *dev, struct event_map *map, struct xwii_event_abs ev[]);
+void handle_accel(struct wii_device *dev, struct event_map *map, struct xwii_event_abs ev[], struct timeval *time);
+void handle_IR(struct wii_device *dev, struct event_map *map, struct xwii_event_abs ev[], struct timeval *time);
+void handle_balance(struct wii_device *dev, struct event_map *map, struct xwii_event_abs ev[]);
+void handle_motionplus(struct wii_device *dev, struct event_map *map, struct xwii_event *ev);
 
 int wiimoteglue_update_all_wiimote_ifaces(struct wii_device_list *devlist) {
   if (devlist == NULL)
@@ -48,18 +52,48 @@ int wiimoteglue_update_wiimote_ifaces(struct wii_device *dev) {
 	return -1;
       }
 
-      if (dev->map->accel_active) {
+      /*Open whatever the base map or any of its layers
+       *need, so switching layers doesn't have to.
+       */
+      int accel = 0;
+      int gyro = 0;
+      int IR = 0;
+      int i;
+      for (i = -1; i < MAX_LAYERS; i++) {
+	struct event_map *map = (i < 0) ? dev->base_map : dev->layer_maps[i];
+	if (map == NULL)
+	  continue;
+	/*Orientation fusion and two-dot IR tracking
+	 *need the accelerometer too.
+	 */
+	accel |= map->accel_active || map->gyro_active > 1 || map->IR_count > 1;
+	accel |= map->waggle_button != NO_MAP;
+	gyro |= map->gyro_active;
+	IR |= map->IR_count;
+      }
+
+      if (accel) {
 	xwii_iface_open(dev->xwii,XWII_IFACE_ACCEL);
       } else {
 	xwii_iface_close(dev->xwii,XWII_IFACE_ACCEL);
+	dev->fusion.have_accel = 0;
       }
 
-      if (dev->map->IR_count) {
+      if (gyro) {
+	if (!(xwii_iface_opened(dev->xwii) & XWII_IFACE_MOTION_PLUS))
+	  motionplus_reset(&dev->fusion);
+	xwii_iface_open(dev->xwii,XWII_IFACE_MOTION_PLUS);
+      } else {
+	xwii_iface_close(dev->xwii,XWII_IFACE_MOTION_PLUS);
+      }
+
+      if (IR) {
 	xwii_iface_open(dev->xwii,XWII_IFACE_IR);
       } else {
 	xwii_iface_close(dev->xwii,XWII_IFACE_IR);
       }
     }
+  return 0;
 }
 
 int wiimoteglue_update_extensions(struct wiimoteglue_state *state, struct wii_device *dev) {
@@ -68,18 +102,6 @@ int wiimoteglue_update_extensions(struct wiimoteglue_state *state, struct wii_de
 
   compute_device_map(state,dev);
 
-  if (dev->map->accel_active) {
-    xwii_iface_open(dev->xwii,XWII_IFACE_ACCEL);
-  } else {
-    xwii_iface_close(dev->xwii,XWII_IFACE_ACCEL);
-  }
-
-  if (dev->map->IR_count) {
-    xwii_iface_open(dev->xwii,XWII_IFACE_IR);
-  } else {
-    xwii_iface_close(dev->xwii,XWII_IFACE_IR);
-  }
-
   if (xwii_iface_available(dev->xwii) == 0 || dev->ifaces == 0) {
     //Controller removed.
     close_wii_device(state, dev);
@@ -88,12 +110,36 @@ int wiimoteglue_update_extensions(struct wiimoteglue_state *state, struct wii_de
   return 0;
 }
 
+static void extension_timer_fire(struct wiimoteglue_state *state, struct wg_timer *timer) {
+  struct wii_device *dev = timer->data;
+  if (dev->xwii != NULL)
+    wiimoteglue_update_extensions(state,dev);
+}
+
+/*Plugging in or pulling out an extension sets off
+ *several udev events and a watch event in a row.
+ *Rather than reopening everything for each one, wait
+ *for them to settle and check the extensions once.
+ */
+void wiimoteglue_queue_extension_update(struct wiimoteglue_state *state, struct wii_device *dev) {
+  if (dev->xwii == NULL || timer_pending(&dev->extension_timer))
+    return;
+
+  dev->extension_timer.fire = extension_timer_fire;
+  dev->extension_timer.data = dev;
+  if (timer_start(&state->timers,&dev->extension_timer,EXTENSION_SETTLE_MS * NS_PER_MS) < 0)
+    wiimoteglue_update_extensions(state,dev);
+}
+
 
 int wiimoteglue_handle_wii_event(struct wiimoteglue_state *state, struct wii_device *dev) {
   struct xwii_event ev;
   if (dev == NULL) {
     return -1;
   }
+  if (dev->xwii == NULL) {
+    return -1; /*closed earlier in this batch of events*/
+  }
 
   int ret = xwii_iface_dispatch(dev->xwii,&ev,sizeof(ev));
   if (dev->slot == NULL && ev.type != XWII_EVENT_GONE) {
@@ -103,7 +149,7 @@ int wiimoteglue_handle_wii_event(struct wiimoteglue_state *state, struct wii_dev
 
   if (ret < 0 && ret != -EAGAIN) {
     printf("Error reading controller. ");
-    close_wii_device(dev);
+    close_wii_device(state, dev);
 
   } else if (ret != -EAGAIN) {
 
@@ -117,166 +163,384 @@ int wiimoteglue_handle_wii_event(struct wiimoteglue_state *state, struct wii_dev
     case XWII_EVENT_CLASSIC_CONTROLLER_KEY:
     case XWII_EVENT_PRO_CONTROLLER_KEY:
     case XWII_EVENT_NUNCHUK_KEY:
-      handle_key(dev->slot->uinput_fd, mapping->button_map, &ev.v.key);
+      handle_key(state, dev, mapping, &ev.v.key);
       break;
     case XWII_EVENT_CLASSIC_CONTROLLER_MOVE:
-      handle_classic(dev->slot->uinput_fd, mapping, ev.v.abs);
+      handle_classic(dev, mapping, ev.v.abs);
       break;
     case XWII_EVENT_NUNCHUK_MOVE:
-      handle_nunchuk(dev->slot->uinput_fd, mapping, ev.v.abs);
+      handle_nunchuk(dev, mapping, ev.v.abs, &ev.time);
       break;
     case XWII_EVENT_PRO_CONTROLLER_MOVE:
-      handle_pro(dev->slot->uinput_fd, mapping, ev.v.abs);
+      handle_pro(dev, mapping, ev.v.abs);
       break;
     case XWII_EVENT_ACCEL:
-      handle_accel(dev->slot->uinput_fd, mapping, ev.v.abs);
+      motionplus_accel(&dev->fusion, ev.v.abs);
+      if (mapping->accel_active || mapping->waggle_button != NO_MAP)
+        handle_accel(dev, mapping, ev.v.abs, &ev.time);
+      break;
+    case XWII_EVENT_MOTION_PLUS:
+      if (mapping->gyro_active)
+        handle_motionplus(dev, mapping, &ev);
       break;
     case XWII_EVENT_IR:
-      handle_IR(dev->slot->uinput_fd, mapping, ev.v.abs);
+      handle_IR(dev, mapping, ev.v.abs, &ev.time);
       break;
     case XWII_EVENT_BALANCE_BOARD:
-      handle_balance(dev->slot->uinput_fd, mapping, ev.v.abs);
+      handle_balance(dev, mapping, ev.v.abs);
       break;
     case XWII_EVENT_WATCH:
+      wiimoteglue_queue_extension_update(state,dev);
+      break;
     case XWII_EVENT_GONE:
+      /*No point waiting; it's not coming back.*/
       wiimoteglue_update_extensions(state,dev);
       break;
 
     }
+    if (ev.type != XWII_EVENT_WATCH && ev.type != XWII_EVENT_GONE)
+      latency_record(&state->event_latency, &ev.time);
   }
 
+  /*Start the mouse motion timer if something
+   *was just pushed onto a relative axis.
+   */
+  if (dev->slot != NULL && dev->slot->rel_moving && !timer_pending(&state->mouse_tick))
+    mouse_update_timer(state);
+
   return 0;
 }
 
-void handle_key(int uinput_fd, int button_map[], struct xwii_event_key *ev) {
-  struct input_event out;
-  memset(&out,0,sizeof(out));
-  out.type = EV_KEY;
-  out.code = button_map[ev->code];
-  out.value = ev->state;
-  write(uinput_fd, &out, sizeof(out));
-
-  out.type  = EV_SYN;
-  out.code = SYN_REPORT;
-  out.value = 0;
-  write(uinput_fd, &out, sizeof(out));
+/*One direction of an axis standing in for a button.
+ *Between the press and release points the button stays
+ *as it was, so an axis wavering around the threshold
+ *doesn't chatter.
+ */
+static void write_axis_key(struct wii_device *dev, int code, int value, int press, int release) {
+  int held = (dev->axis_keys[code/8] >> (code%8)) & 1;
+  int down = held;
+
+  if (value >= press)
+    down = 1;
+  else if (value < release)
+    down = 0;
+  if (down == held)
+    return;
+
+  dev->axis_keys[code/8] ^= 1 << (code%8);
+  slot_merge_key(dev, code, down);
+}
+
+static void write_axis_button(struct wii_device *dev, int16_t *axis, int value) {
+  int pos = axis[AXIS_CODE] & ~WG_AXIS_BUTTON;
+  int neg = axis[AXIS_NEG_BUTTON];
+
+  if (pos)
+    write_axis_key(dev, pos, value, axis[AXIS_PRESS], axis[AXIS_RELEASE]);
+  if (neg)
+    write_axis_key(dev, neg, -value, axis[AXIS_PRESS], axis[AXIS_RELEASE]);
+}
+
+/*Let go of any buttons held down by axes.
+ *Only queued; the caller sends the frame.
+ */
+void axis_keys_release(struct wii_device *dev) {
+  int code;
+  for (code = 0; code < MAX_OUTPUT_KEY; code++) {
+    if (!(dev->axis_keys[code/8] & (1 << (code%8))))
+      continue;
+    slot_merge_key(dev, code, 0);
+  }
+  memset(dev->axis_keys,0,sizeof(dev->axis_keys));
+}
+
+/*Runs a scaled value through the axis's response curve
+ *and sends it on. Axes mapped to the mouse's relative
+ *motion are handed to the mouse timer as a velocity instead.
+ */
+static void write_axis(struct wii_device *dev, int16_t *axis, int value) {
+  int code = axis[AXIS_CODE];
+  if (code == NO_MAP)
+    return;
+
+  if (axis[AXIS_CURVE])
+    value = response_apply(axis[AXIS_CURVE], value);
+
+  /*Checked first, since button codes can
+   *look like they have WG_REL_AXIS set.
+   */
+  if (code & WG_AXIS_BUTTON) {
+    write_axis_button(dev, axis, value);
+    return;
+  }
+
+  if (code & WG_REL_AXIS) {
+    mouse_set_velocity(dev, code & ~WG_REL_AXIS, value);
+    return;
+  }
+
+  slot_merge_abs(dev, code, value);
+}
+
+/*Like write_axis, but through the axis's smoothing filter first.*/
+static void write_smoothed(struct wii_device *dev, int16_t *axis, struct euro_state *filter, struct timeval *time, int value) {
+  write_axis(dev, axis, response_smooth(axis[AXIS_CURVE], filter, value, time));
+}
+
+/*Sends everything the slot has queued up as one frame.*/
+static void write_syn(struct virtual_controller *slot) {
+  slot_merge_flush(slot);
+}
+
+/*Centers each axis in a list of rows, so a layer that
+ *maps the sticks elsewhere doesn't leave the old axes
+ *(or the mouse) pushed. Axis buttons are released
+ *separately, by axis_keys_release.
+ */
+static void center_axes(struct wii_device *dev, int16_t (*rows)[AXIS_FIELDS], int count) {
+  int i;
+  for (i = 0; i < count; i++) {
+    int16_t row[AXIS_FIELDS] = {rows[i][AXIS_CODE]};
+    if (row[AXIS_CODE] == NO_MAP || (row[AXIS_CODE] & WG_AXIS_BUTTON))
+      continue;
+    write_axis(dev, row, 0);
+  }
+}
+
+/*Switch to another layer (layer+1, or 0 for the base map).
+ *Whatever the old layer was holding down or pushing on
+ *is let go, and buttons still held stay quiet until
+ *they are released.
+ */
+static void switch_layer(struct wii_device *dev, int layer) {
+  struct virtual_controller *slot = dev->slot;
+  int i;
+
+  if (layer == dev->layer)
+    return;
+
+  turbo_stop_device(dev);
+  axis_keys_release(dev);
+
+  for (i = 0; i < XWII_KEY_NUM; i++) {
+    if (!dev->key_down[i] || dev->key_output[i] == NO_MAP)
+      continue;
+    if (dev->key_output[i] & WG_BUTTON_AXIS) {
+      int16_t row[AXIS_FIELDS] = {dev->key_output[i] & ~WG_BUTTON_AXIS};
+      write_axis(dev, row, 0);
+      dev->key_output[i] = NO_MAP;
+      continue;
+    }
+    slot_merge_key(dev, dev->key_output[i], 0);
+    dev->key_output[i] = NO_MAP;
+  }
+
+  struct event_map *old = dev->map;
+  center_axes(dev, old->accel_map, 6);
+  center_axes(dev, old->stick_map, 8);
+  center_axes(dev, old->balance_map, 7);
+  center_axes(dev, old->IR_map, 4);
+  center_axes(dev, old->gyro_map, 6);
+  write_syn(slot);
+
+  dev->layer = layer;
+  if (layer > 0 && dev->layer_maps[layer-1] != NULL)
+    dev->map = dev->layer_maps[layer-1];
+  else
+    dev->map = dev->base_map;
+}
+
+/*A button standing in for an axis. Pressed, it pushes the
+ *axis to its button_value; released, the axis goes back to
+ *center, unless another held button is pushing on it too.
+ */
+static void write_button_axis(struct wii_device *dev, struct event_map *map, int button, int code, int state) {
+  int16_t row[AXIS_FIELDS] = {code & ~WG_BUTTON_AXIS};
+  int value = 0;
+  int i;
+
+  if (state == 2)
+    return; /*auto-repeat*/
+
+  if (state == 1) {
+    value = map->button_value[button];
+  } else {
+    for (i = 0; i < XWII_KEY_NUM; i++) {
+      if (i != button && dev->key_down[i] && dev->key_output[i] == code)
+        value = map->button_value[i];
+    }
+  }
+
+  write_axis(dev, row, value);
+}
+
+void handle_key(struct wiimoteglue_state *state, struct wii_device *dev, struct event_map *map, struct xwii_event_key *ev) {
+  struct virtual_controller *slot = dev->slot;
+  if (ev->code >= XWII_KEY_NUM)
+    return;
+
+  /*Shift buttons only pick the layer.*/
+  int layer = dev->shift_layer[ev->code];
+  if (layer) {
+    if (ev->state == 1)
+      switch_layer(dev, layer);
+    else if (ev->state == 0 && dev->layer == layer)
+      switch_layer(dev, 0);
+    return;
+  }
+
+  /*Turbo buttons and macros run on their own timers.*/
+  if (ev->state && turbo_press(state, dev, map, ev->code))
+    return;
+  if (!ev->state && turbo_release(dev, ev->code))
+    return;
+
+  int code = map->button_map[ev->code];
+  if (ev->state == 1) {
+    dev->key_down[ev->code] = 1;
+    dev->key_output[ev->code] = code;
+  } else if (dev->key_down[ev->code]) {
+    code = dev->key_output[ev->code];
+    if (ev->state == 0)
+      dev->key_down[ev->code] = 0;
+  }
+  if (code == NO_MAP)
+    return;
+
+  if (code & WG_BUTTON_AXIS) {
+    write_button_axis(dev, map, ev->code, code, ev->state);
+    write_syn(slot);
+    return;
+  }
+
+  slot_merge_key(dev, code, ev->state);
+  write_syn(slot);
+}
+
+/*Presses the waggle button when a shake starts,
+ *and releases it when the shake dies down.
+ */
+static void handle_waggle(struct wii_device *dev, struct waggle_detector *waggle, int code, struct event_map *map, struct xwii_event_abs *accel, struct timeval *time) {
+  struct virtual_controller *slot = dev->slot;
+  if (code == NO_MAP && !waggle->active)
+    return;
+
+  int change = waggle_update(waggle, accel, map->waggle_threshold, map->waggle_cooldown, time);
+  if (change == 0)
+    return;
+
+  if (change > 0)
+    waggle->code = code;
+  if (waggle->code == NO_MAP)
+    return;
+
+  slot_merge_key(dev, waggle->code, change > 0);
+  write_syn(slot);
 }
 
-void handle_nunchuk(int uinput_fd, struct event_map *map, struct xwii_event_abs ev[]) {
-  struct input_event out;
-  memset(&out,0,sizeof(out));
-  out.type = EV_ABS;
-  out.code = map->stick_map[WG_N_X][AXIS_CODE];
-  out.value = ev[0].x * map->stick_map[WG_N_X][AXIS_SCALE];
-  write(uinput_fd, &out, sizeof(out));
-  out.code = map->stick_map[WG_N_Y][AXIS_CODE];
-  out.value = ev[0].y * map->stick_map[WG_N_Y][AXIS_SCALE];
-  write(uinput_fd, &out, sizeof(out));
-
-  out.type  = EV_SYN;
-  out.code = SYN_REPORT;
-  out.value = 0;
-  write(uinput_fd, &out, sizeof(out));
+void handle_nunchuk(struct wii_device *dev, struct event_map *map, struct xwii_event_abs ev[], struct timeval *time) {
+  struct virtual_controller *slot = dev->slot;
+  write_axis(dev, map->stick_map[WG_N_X],
+             ev[0].x * map->stick_map[WG_N_X][AXIS_SCALE]);
+  write_axis(dev, map->stick_map[WG_N_Y],
+             ev[0].y * map->stick_map[WG_N_Y][AXIS_SCALE]);
+
+  write_syn(slot);
+
+  handle_waggle(dev, &dev->waggle[1], map->nunchuk_waggle_button, map, &ev[1], time);
 
   if (!map->accel_active) return; /*skip the accel values.*/
 
-  out.type = EV_ABS;
-  out.code = map->accel_map[WG_N_ACCELX][AXIS_CODE];
-  out.value = ev[1].x * map->accel_map[WG_N_ACCELX][AXIS_SCALE];
-  write(uinput_fd, &out, sizeof(out));
-  out.code = map->accel_map[WG_N_ACCELY][AXIS_CODE];
-  out.value = ev[1].y * map->accel_map[WG_N_ACCELY][AXIS_SCALE];
-  write(uinput_fd, &out, sizeof(out));
-  out.code = map->accel_map[WG_N_ACCELZ][AXIS_CODE];
-  out.value = ev[1].z * map->accel_map[WG_N_ACCELZ][AXIS_SCALE];
-  write(uinput_fd, &out, sizeof(out));
-
-  out.type  = EV_SYN;
-  out.code = SYN_REPORT;
-  out.value = 0;
-  write(uinput_fd, &out, sizeof(out));
+  write_smoothed(dev, map->accel_map[WG_N_ACCELX], &dev->smooth_accel[WG_N_ACCELX], time,
+                 ev[1].x * map->accel_map[WG_N_ACCELX][AXIS_SCALE]);
+  write_smoothed(dev, map->accel_map[WG_N_ACCELY], &dev->smooth_accel[WG_N_ACCELY], time,
+                 ev[1].y * map->accel_map[WG_N_ACCELY][AXIS_SCALE]);
+  write_smoothed(dev, map->accel_map[WG_N_ACCELZ], &dev->smooth_accel[WG_N_ACCELZ], time,
+                 ev[1].z * map->accel_map[WG_N_ACCELZ][AXIS_SCALE]);
+
+  write_syn(slot);
 
 }
-void handle_classic(int uinput_fd, struct event_map *map, struct xwii_event_abs ev[]) {
-  struct input_event out;
-  memset(&out,0,sizeof(out));
-  out.type = EV_ABS;
-  out.code = map->stick_map[WG_LEFT_X][AXIS_CODE];
-  out.value = ev[0].x * map->stick_map[WG_LEFT_X][AXIS_SCALE];
-  write(uinput_fd, &out, sizeof(out));
-  out.code = map->stick_map[WG_LEFT_Y][AXIS_CODE];
-  out.value = ev[0].y * map->stick_map[WG_LEFT_Y][AXIS_SCALE];
-  write(uinput_fd, &out, sizeof(out));
-  out.code = map->stick_map[WG_RIGHT_X][AXIS_CODE];
-  out.value = ev[1].x * map->stick_map[WG_RIGHT_X][AXIS_SCALE];
-  write(uinput_fd, &out, sizeof(out));
-  out.code = map->stick_map[WG_RIGHT_Y][AXIS_CODE];
-  out.value = ev[1].y * map->stick_map[WG_RIGHT_Y][AXIS_SCALE];
-  write(uinput_fd, &out, sizeof(out));
-
-  out.type  = EV_SYN;
-  out.code = SYN_REPORT;
-  out.value = 0;
-  write(uinput_fd, &out, sizeof(out));
-  /*analog trigger values are ignored.
-   *only the original classic controllers have them.
+void handle_classic(struct wii_device *dev, struct event_map *map, struct xwii_event_abs ev[]) {
+  struct virtual_controller *slot = dev->slot;
+  write_axis(dev, map->stick_map[WG_LEFT_X],
+             ev[0].x * map->stick_map[WG_LEFT_X][AXIS_SCALE]);
+  write_axis(dev, map->stick_map[WG_LEFT_Y],
+             ev[0].y * map->stick_map[WG_LEFT_Y][AXIS_SCALE]);
+  write_axis(dev, map->stick_map[WG_RIGHT_X],
+             ev[1].x * map->stick_map[WG_RIGHT_X][AXIS_SCALE]);
+  write_axis(dev, map->stick_map[WG_RIGHT_Y],
+             ev[1].y * map->stick_map[WG_RIGHT_Y][AXIS_SCALE]);
+
+  /*Only the original classic controllers have analog
+   *triggers; the Classic Controller Pro leaves these at 0.
    */
+  write_axis(dev, map->stick_map[WG_L_TRIGGER],
+             ev[2].x * map->stick_map[WG_L_TRIGGER][AXIS_SCALE]);
+  write_axis(dev, map->stick_map[WG_R_TRIGGER],
+             ev[2].y * map->stick_map[WG_R_TRIGGER][AXIS_SCALE]);
+
+  write_syn(slot);
 }
-void handle_pro(int uinput_fd, struct event_map *map, struct xwii_event_abs ev[]) {
-  struct input_event out;
-  memset(&out,0,sizeof(out));
-  out.type = EV_ABS;
-  out.code = map->stick_map[WG_LEFT_X][AXIS_CODE];
-  out.value = ev[0].x * 32;
-  write(uinput_fd, &out, sizeof(out));
-  out.code = map->stick_map[WG_LEFT_Y][AXIS_CODE];
-  out.value = ev[0].y * 32;
-  write(uinput_fd, &out, sizeof(out));
-  out.code = map->stick_map[WG_RIGHT_X][AXIS_CODE];
-  out.value = ev[1].x * 32;
-  write(uinput_fd, &out, sizeof(out));
-  out.code = map->stick_map[WG_RIGHT_Y][AXIS_CODE];
-  out.value = ev[1].y * 32;
-  write(uinput_fd, &out, sizeof(out));
-
-  /*Wii U Pro has different axis limits, hardcoded above to
-   * scale from ~1024 to 32,768, the reported scale of
-   * the virtual gamepads.
-   * This means the Wii U Pro does not support inverting
-   * the axes!
-   */
+/*The Wii U Pro shares the classic mode mapping, but has
+ *different axis limits. Keep the mapping's direction
+ *but use the Pro's own scale.
+ */
+static int pro_value(int raw, int16_t *axis) {
+  return (axis[AXIS_SCALE] < 0) ? -raw * PRO_SCALE : raw * PRO_SCALE;
+}
+
+void handle_pro(struct wii_device *dev, struct event_map *map, struct xwii_event_abs ev[]) {
+  struct virtual_controller *slot = dev->slot;
+  write_axis(dev, map->stick_map[WG_LEFT_X],
+             pro_value(ev[0].x, map->stick_map[WG_LEFT_X]));
+  write_axis(dev, map->stick_map[WG_LEFT_Y],
+             pro_value(ev[0].y, map->stick_map[WG_LEFT_Y]));
+  write_axis(dev, map->stick_map[WG_RIGHT_X],
+             pro_value(ev[1].x, map->stick_map[WG_RIGHT_X]));
+  write_axis(dev, map->stick_map[WG_RIGHT_Y],
+             pro_value(ev[1].y, map->stick_map[WG_RIGHT_Y]));
 
-  out.type  = EV_SYN;
-  out.code = SYN_REPORT;
-  out.value = 0;
-  write(uinput_fd, &out, sizeof(out));
+  write_syn(slot);
 
 }
-void handle_accel(int uinput_fd, struct event_map *map, struct xwii_event_abs ev[]) {
-  struct input_event out;
-  memset(&out,0,sizeof(out));
-  out.type = EV_ABS;
-  out.code = map->accel_map[WG_ACCELX][AXIS_CODE];
-  out.value = ev[0].x * map->accel_map[WG_ACCELX][AXIS_SCALE];
-  write(uinput_fd, &out, sizeof(out));
-  out.code = map->accel_map[WG_ACCELY][AXIS_CODE];
-  out.value = ev[0].y * map->accel_map[WG_ACCELY][AXIS_SCALE];
-  write(uinput_fd, &out, sizeof(out));
-  out.code = map->accel_map[WG_ACCELZ][AXIS_CODE];
-  out.value = ev[0].z * map->accel_map[WG_ACCELZ][AXIS_SCALE];
-  write(uinput_fd, &out, sizeof(out));
-
-
-
-  out.type  = EV_SYN;
-  out.code = SYN_REPORT;
-  out.value = 0;
-  write(uinput_fd, &out, sizeof(out));
+void handle_accel(struct wii_device *dev, struct event_map *map, struct xwii_event_abs ev[], struct timeval *time) {
+  struct virtual_controller *slot = dev->slot;
+
+  /*Shaking works even if the tilt axes aren't wanted.*/
+  handle_waggle(dev, &dev->waggle[0], map->waggle_button, map, &ev[0], time);
+  if (!map->accel_active)
+    return;
+
+  write_smoothed(dev, map->accel_map[WG_ACCELX], &dev->smooth_accel[WG_ACCELX], time,
+                 ev[0].x * map->accel_map[WG_ACCELX][AXIS_SCALE]);
+  write_smoothed(dev, map->accel_map[WG_ACCELY], &dev->smooth_accel[WG_ACCELY], time,
+                 ev[0].y * map->accel_map[WG_ACCELY][AXIS_SCALE]);
+  write_smoothed(dev, map->accel_map[WG_ACCELZ], &dev->smooth_accel[WG_ACCELZ], time,
+                 ev[0].z * map->accel_map[WG_ACCELZ][AXIS_SCALE]);
+
+  write_syn(slot);
 }
-void handle_IR(int uinput_fd, struct event_map *map, struct xwii_event_abs ev[]) {
-  struct input_event out;
-  memset(&out,0,sizeof(out));
-  out.type = EV_ABS;
+void handle_IR(struct wii_device *dev, struct event_map *map, struct xwii_event_abs ev[], struct timeval *time) {
+  struct virtual_controller *slot = dev->slot;
+
+  if (map->IR_count > 1) {
+    /*Track both sensor bar dots.*/
+    struct ir_tracker *ir = &dev->ir;
+    if (ir_track(ir, ev, &dev->fusion, time, map->IR_predict)) {
+      write_smoothed(dev, map->IR_map[WG_IR_X], &dev->smooth_IR[WG_IR_X], time,
+                     -(ir->out_x * map->IR_map[WG_IR_X][AXIS_SCALE]) / 16);
+      write_smoothed(dev, map->IR_map[WG_IR_Y], &dev->smooth_IR[WG_IR_Y], time,
+                     (ir->out_y * map->IR_map[WG_IR_Y][AXIS_SCALE]) / 16);
+      write_axis(dev, map->IR_map[WG_IR_DIST],
+                 (ir->dist - 256) * map->IR_map[WG_IR_DIST][AXIS_SCALE]);
+      write_axis(dev, map->IR_map[WG_IR_ROLL],
+                 ir->roll * map->IR_map[WG_IR_ROLL][AXIS_SCALE]);
+    }
+    write_syn(slot);
+    return;
+  }
+
   int num = 0;
   float x = 1023;
   float y = 1023;
@@ -291,27 +555,30 @@ void handle_IR(int uinput_fd, struct event_map *map, struct xwii_event_abs ev[])
     }
   }
   if (num != 0) {
-  out.code = map->IR_map[WG_IR_X][AXIS_CODE];
-  out.value = (int) (-((x - 512) * map->IR_map[WG_IR_X][AXIS_SCALE]));
-  write(uinput_fd, &out, sizeof(out));
-  out.code = map->IR_map[WG_IR_Y][AXIS_CODE];
-  out.value = (int) (((y - 380) * map->IR_map[WG_IR_Y][AXIS_SCALE]));
-  write(uinput_fd, &out, sizeof(out));
+    write_smoothed(dev, map->IR_map[WG_IR_X], &dev->smooth_IR[WG_IR_X], time,
+                 (int) (-((x - 512) * map->IR_map[WG_IR_X][AXIS_SCALE])));
+    write_smoothed(dev, map->IR_map[WG_IR_Y], &dev->smooth_IR[WG_IR_Y], time,
+                 (int) (((y - 380) * map->IR_map[WG_IR_Y][AXIS_SCALE])));
   }
 
-  out.type  = EV_SYN;
-  out.code = SYN_REPORT;
-  out.value = 0;
-  write(uinput_fd, &out, sizeof(out));
+  write_syn(slot);
 }
-void handle_balance(int uinput_fd, struct event_map *map, struct xwii_event_abs ev[]) {
-  struct input_event out;
-  memset(&out,0,sizeof(out));
-  out.type = EV_ABS;
-  int total = ev[0].x + ev[1].x + ev[2].x + ev[3].x;
-  int left = ev[2].x + ev[3].x;
+void handle_balance(struct wii_device *dev, struct event_map *map, struct xwii_event_abs ev[]) {
+  struct virtual_controller *slot = dev->slot;
+  int corner[4];
+  int weight = balance_update(&dev->balance, ev, corner);
+  int i;
+
+  for (i = WG_BAL_FL; i <= WG_BAL_BR; i++)
+    write_axis(dev, map->balance_map[i],
+               corner[i] * map->balance_map[i][AXIS_SCALE]);
+  write_axis(dev, map->balance_map[WG_BAL_WEIGHT],
+             weight * map->balance_map[WG_BAL_WEIGHT][AXIS_SCALE]);
+
+  int total = corner[WG_BAL_FL] + corner[WG_BAL_FR] + corner[WG_BAL_BL] + corner[WG_BAL_BR];
+  int left = corner[WG_BAL_FL] + corner[WG_BAL_BL];
   int right = total - left;
-  int front = ev[0].x + ev[2].x;
+  int front = corner[WG_BAL_FL] + corner[WG_BAL_FR];
   int back = total - front;
 
   /*Beware: lots of constants from experimentation below!*/
@@ -324,20 +591,33 @@ void handle_balance(int uinput_fd, struct event_map *map, struct xwii_event_abs
     y = 0;
   }
 
-  out.code = map->balance_map[WG_BAL_X][AXIS_CODE];
-  out.value = (int)(x * map->balance_map[WG_BAL_X][AXIS_SCALE]);
-  write(uinput_fd, &out, sizeof(out));
-
-  out.code = map->balance_map[WG_BAL_Y][AXIS_CODE];
-  out.value = (int)(y * map->balance_map[WG_BAL_Y][AXIS_SCALE]);
-  write(uinput_fd, &out, sizeof(out));
-
+  write_axis(dev, map->balance_map[WG_BAL_X],
+             (int)(x * map->balance_map[WG_BAL_X][AXIS_SCALE]));
+  write_axis(dev, map->balance_map[WG_BAL_Y],
+             (int)(y * map->balance_map[WG_BAL_Y][AXIS_SCALE]));
 
-  out.type  = EV_SYN;
-  out.code = SYN_REPORT;
-  out.value = 0;
-  write(uinput_fd, &out, sizeof(out));
+  write_syn(slot);
 }
+void handle_motionplus(struct wii_device *dev, struct event_map *map, struct xwii_event *ev) {
+  struct virtual_controller *slot = dev->slot;
+  struct motion_fusion *fusion = &dev->fusion;
+  motionplus_rates(fusion, ev->v.abs);
 
+  int i;
+  for (i = WG_GYRO_X; i <= WG_GYRO_Z; i++) {
+    write_axis(dev, map->gyro_map[i],
+               (int)(fusion->rate[i] * map->gyro_map[i][AXIS_SCALE]));
+  }
+
+  if (map->gyro_active > 1) {
+    motionplus_fuse(fusion, &ev->time);
+    float angles[3] = {fusion->pitch, fusion->roll, fusion->yaw};
 
+    for (i = WG_PITCH; i <= WG_YAW; i++) {
+      write_axis(dev, map->gyro_map[i],
+                 (int)(angles[i - WG_PITCH] * map->gyro_map[i][AXIS_SCALE]));
+    }
+  }
 
+  write_syn(slot);
+}
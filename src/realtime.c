@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wiimoteglue.h"
+
+/* Real-time mode (--realtime and --cpus), and keeping
+ * track of how long input events take to get through.
+ *
+ * Under a busy game, WiimoteGlue can be preempted or
+ * stall on a page fault between reading an event and
+ * writing it out. Running SCHED_FIFO keeps ordinary
+ * processes from getting in first, locking memory keeps
+ * page faults away, and pinning to a quiet CPU keeps
+ * it from bouncing between caches.
+ *
+ * This needs CAP_SYS_NICE or an rtprio limit (see
+ * limits.conf) for the priority, and a big enough
+ * memlock limit for mlockall. Anything that can't be
+ * done is reported and skipped.
+ */
+
+#define RT_STACK_PREFAULT (256*1024)
+#define LATENCY_MAX_US 1000000 /*anything later is a clock change*/
+
+/*Parses a list of CPUs like "1" or "0,2-3".
+ *Returns the number of CPUs, or -1 if it isn't valid.
+ */
+static int parse_cpus(char *list, cpu_set_t *set) {
+  char *pos = list;
+  int count = 0;
+  CPU_ZERO(set);
+
+  while (*pos != '\0') {
+    char *end;
+    long first = strtol(pos,&end,10);
+    long last = first;
+    if (end == pos || first < 0)
+      return -1;
+    pos = end;
+    if (*pos == '-') {
+      pos++;
+      last = strtol(pos,&end,10);
+      if (end == pos || last < first)
+        return -1;
+      pos = end;
+    }
+    if (last >= CPU_SETSIZE)
+      return -1;
+    for (; first <= last; first++) {
+      if (!CPU_ISSET(first,set))
+        count++;
+      CPU_SET(first,set);
+    }
+    if (*pos == ',')
+      pos++;
+    else if (*pos != '\0')
+      return -1;
+  }
+  return count > 0 ? count : -1;
+}
+
+int realtime_check_cpus(char *list) {
+  cpu_set_t set;
+  return parse_cpus(list,&set) > 0 ? 0 : -1;
+}
+
+/*Touch a good chunk of stack now, so mlockall has
+ *it mapped before the event loop ever needs it.
+ */
+static void prefault_stack() {
+  volatile char buffer[RT_STACK_PREFAULT];
+  memset((char*)buffer,0,sizeof(buffer));
+}
+
+/*Call once everything is set up, just before the event loop.
+ *priority 0 leaves the scheduling alone, and cpus can be NULL.
+ */
+int wiimoteglue_realtime_init(struct wiimoteglue_state *state, int priority, char *cpus) {
+  int ret = 0;
+
+  if (cpus != NULL) {
+    cpu_set_t set;
+    if (parse_cpus(cpus,&set) < 0) {
+      printf("CPU list \"%s\" not recognized.\n",cpus);
+      ret = -1;
+    } else if (sched_setaffinity(0,sizeof(set),&set) < 0) {
+      perror("sched_setaffinity");
+      ret = -1;
+    } else {
+      printf("Running on CPU(s) %s.\n",cpus);
+    }
+  }
+
+  if (priority <= 0)
+    return ret;
+
+  /*Keep freed memory around rather than handing it back
+   *to the system, and never give a malloc its own mapping,
+   *so malloc doesn't go through fresh, unlocked pages.
+   */
+  mallopt(M_TRIM_THRESHOLD,-1);
+  mallopt(M_MMAP_MAX,0);
+  prefault_stack();
+
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+    perror("mlockall");
+    printf("Memory isn't locked; check the memlock limit (ulimit -l).\n");
+    ret = -1;
+  }
+
+  struct sched_param param;
+  memset(&param,0,sizeof(param));
+  int max = sched_get_priority_max(SCHED_FIFO);
+  param.sched_priority = (priority > max) ? max : priority;
+  if (sched_setscheduler(0,SCHED_FIFO,&param) < 0) {
+    perror("sched_setscheduler");
+    printf("Not running real-time; this needs CAP_SYS_NICE or an rtprio limit.\n");
+    return -1;
+  }
+
+  state->realtime_priority = param.sched_priority;
+  printf("Running real-time (SCHED_FIFO, priority %d).\n",param.sched_priority);
+  return ret;
+}
+
+/*Note how long ago an input event happened, once it's been sent on.
+ *Event times come from the kernel's input layer, on the wall clock.
+ */
+void latency_record(struct latency_stats *stats, struct timeval *time) {
+  struct timeval now;
+  gettimeofday(&now,NULL);
+
+  long long us = (long long)(now.tv_sec - time->tv_sec) * 1000000
+    + (now.tv_usec - time->tv_usec);
+  if (us < 0 || us > LATENCY_MAX_US)
+    return;
+
+  stats->count++;
+  stats->total += us;
+  stats->total_sq += (double)us * us;
+  if ((uint64_t)us > stats->max) /*not negative, checked above*/
+    stats->max = us;
+
+  int i = 0;
+  long long limit = LATENCY_FIRST_BUCKET_US;
+  while (i < LATENCY_BUCKETS - 1 && us >= limit) {
+    limit *= 2;
+    i++;
+  }
+  stats->buckets[i]++;
+}
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "wiimoteglue.h"
+
+/* The device registry remembers each device's name,
+ * slot, and device specific mapping by its bluetooth
+ * address. It is kept in a small text file, so a
+ * controller reconnecting (even after a restart)
+ * lands back where it was without any "assign" commands.
+ *
+ * Each line of the file is
+ *   <address> <id> <slot|-> <mapping|-> [tare]
+ * where a balance board's tare is its four sensor
+ * offsets, as <fl>,<fr>,<bl>,<br>.
+ */
+
+static unsigned int registry_hash(char *addr) {
+  /*FNV-1a*/
+  unsigned int hash = 2166136261u;
+  for (; *addr != '\0'; addr++) {
+    hash ^= (unsigned char) *addr;
+    hash *= 16777619u;
+  }
+  return hash % REGISTRY_BUCKETS;
+}
+
+struct registry_entry* registry_lookup(struct wiimoteglue_state *state, char *addr) {
+  if (addr == NULL)
+    return NULL;
+
+  struct registry_entry *entry = state->registry[registry_hash(addr)];
+  for (; entry != NULL; entry = entry->next) {
+    if (strncmp(entry->bluetooth_addr,addr,sizeof(entry->bluetooth_addr)) == 0)
+      return entry;
+  }
+  return NULL;
+}
+
+static struct registry_entry* registry_add(struct wiimoteglue_state *state, char *addr) {
+  struct registry_entry *entry = calloc(1,sizeof(struct registry_entry));
+  strncpy(entry->bluetooth_addr,addr,sizeof(entry->bluetooth_addr)-1);
+
+  unsigned int bucket = registry_hash(entry->bluetooth_addr);
+  entry->next = state->registry[bucket];
+  state->registry[bucket] = entry;
+  return entry;
+}
+
+/*Is this name already remembered for some other device?*/
+int registry_id_in_use(struct wiimoteglue_state *state, char *id, char *addr) {
+  int i;
+  for (i = 0; i < REGISTRY_BUCKETS; i++) {
+    struct registry_entry *entry = state->registry[i];
+    for (; entry != NULL; entry = entry->next) {
+      if (strncmp(entry->id,id,WG_MAX_NAME_SIZE) == 0 &&
+          (addr == NULL || strncmp(entry->bluetooth_addr,addr,sizeof(entry->bluetooth_addr)) != 0))
+        return 1;
+    }
+  }
+  return 0;
+}
+
+static void copy_field(char *dest, char *src) {
+  if (strcmp(src,"-") == 0)
+    src = "";
+  strncpy(dest,src,WG_MAX_NAME_SIZE-1);
+  dest[WG_MAX_NAME_SIZE-1] = '\0';
+}
+
+int wiimoteglue_registry_load(struct wiimoteglue_state *state, char *filename) {
+  state->registry_path = filename;
+  if (filename == NULL)
+    return 0;
+
+  FILE *file = fopen(filename,"r");
+  if (file == NULL) {
+    if (errno == ENOENT)
+      return 0; /*Nothing remembered yet.*/
+    printf("Could not read device registry \'%s\'\n",filename);
+    perror("fopen");
+    return -1;
+  }
+
+  char line[256];
+  char addr[32], id[64], slot[64], mapping[64];
+  int tare[4];
+  int count = 0;
+  while (fgets(line,sizeof(line),file) != NULL) {
+    int end = 0;
+    if (line[0] == '#')
+      continue;
+    if (sscanf(line,"%31s %63s %63s %63s%n",addr,id,slot,mapping,&end) != 4)
+      continue;
+    if (strlen(addr) > 17)
+      continue;
+
+    struct registry_entry *entry = registry_lookup(state,addr);
+    if (entry == NULL)
+      entry = registry_add(state,addr);
+
+    copy_field(entry->id,id);
+    copy_field(entry->slot_name,slot);
+    copy_field(entry->mapping_name,mapping);
+    entry->has_tare = (sscanf(line+end," %d,%d,%d,%d",&tare[0],&tare[1],&tare[2],&tare[3]) == 4);
+    if (entry->has_tare)
+      memcpy(entry->tare,tare,sizeof(tare));
+    count++;
+  }
+  fclose(file);
+
+  printf("Remembered %d device(s) from \'%s\'\n",count,filename);
+  return 0;
+}
+
+int wiimoteglue_registry_save(struct wiimoteglue_state *state) {
+  if (state->registry_path == NULL)
+    return 0;
+
+  /*Write a new file and rename it over the old one,
+   *so a crash never leaves a half-written registry.
+   */
+  char tmp_path[1024];
+  snprintf(tmp_path,sizeof(tmp_path),"%s.tmp",state->registry_path);
+  FILE *file = fopen(tmp_path,"w");
+  if (file == NULL) {
+    printf("Could not write device registry \'%s\'\n",tmp_path);
+    perror("fopen");
+    return -1;
+  }
+
+  fprintf(file,"# WiimoteGlue device registry\n");
+  fprintf(file,"# <address> <id> <slot|-> <mapping|-> [balance board tare]\n");
+  int i;
+  for (i = 0; i < REGISTRY_BUCKETS; i++) {
+    struct registry_entry *entry = state->registry[i];
+    for (; entry != NULL; entry = entry->next) {
+      fprintf(file,"%s %s %s %s",entry->bluetooth_addr,
+              entry->id[0] ? entry->id : "-",
+              entry->slot_name[0] ? entry->slot_name : "-",
+              entry->mapping_name[0] ? entry->mapping_name : "-");
+      if (entry->has_tare)
+        fprintf(file," %d,%d,%d,%d",entry->tare[0],entry->tare[1],entry->tare[2],entry->tare[3]);
+      fprintf(file,"\n");
+    }
+  }
+
+  if (fclose(file) != 0 || rename(tmp_path,state->registry_path) < 0) {
+    perror("saving device registry");
+    return -1;
+  }
+  return 0;
+}
+
+/*Record the device's current settings, saving the
+ *registry only if something actually changed.
+ */
+int registry_remember_device(struct wiimoteglue_state *state, struct wii_device *dev) {
+  if (state->registry_path == NULL || dev == NULL)
+    return 0;
+
+  struct registry_entry *entry = registry_lookup(state,dev->bluetooth_addr);
+  if (entry == NULL)
+    entry = registry_add(state,dev->bluetooth_addr);
+
+  struct registry_entry old = *entry;
+
+  copy_field(entry->id,dev->id);
+  if (dev->slot != NULL)
+    copy_field(entry->slot_name,dev->slot->slot_name);
+  if (dev->dev_specific_mappings != NULL)
+    copy_field(entry->mapping_name,dev->dev_specific_mappings->name);
+  entry->has_tare = dev->balance.has_tare;
+  memcpy(entry->tare,dev->balance.tare,sizeof(entry->tare));
+
+  if (memcmp(&old,entry,sizeof(old)) == 0)
+    return 0;
+
+  return wiimoteglue_registry_save(state);
+}
+
+/*A remembered mapping is only dropped when the user
+ *says so, not just because it wasn't loaded yet.
+ */
+int registry_forget_mapping(struct wiimoteglue_state *state, struct wii_device *dev) {
+  struct registry_entry *entry = registry_lookup(state,dev->bluetooth_addr);
+  if (entry == NULL || entry->mapping_name[0] == '\0')
+    return 0;
+
+  entry->mapping_name[0] = '\0';
+  return wiimoteglue_registry_save(state);
+}
+
+/*Likewise for the slot, once the user takes the
+ *device out of its slot on purpose.
+ */
+int registry_forget_slot(struct wiimoteglue_state *state, struct wii_device *dev) {
+  struct registry_entry *entry = registry_lookup(state,dev->bluetooth_addr);
+  if (entry == NULL || entry->slot_name[0] == '\0')
+    return 0;
+
+  entry->slot_name[0] = '\0';
+  return wiimoteglue_registry_save(state);
+}
+
+/*A device can show up before its remembered mapping is
+ *created. Once it is, give it to those devices.
+ */
+int registry_restore_mapping(struct wiimoteglue_state *state, struct mode_mappings *maps) {
+  struct wii_device_list *list_node = state->dev_list.next;
+  for (; list_node != &state->dev_list && list_node != NULL; list_node = list_node->next) {
+    struct wii_device *dev = list_node->dev;
+    if (dev == NULL || dev->dev_specific_mappings != NULL)
+      continue;
+    struct registry_entry *entry = registry_lookup(state,dev->bluetooth_addr);
+    if (entry == NULL || strncmp(entry->mapping_name,maps->name,WG_MAX_NAME_SIZE) != 0)
+      continue;
+
+    printf("%s now has its remembered mapping \"%s\".\n",dev->id,maps->name);
+    set_device_specific_mappings(dev,maps);
+    if (!state->staging)
+      compute_device_map(state,dev);
+  }
+  return 0;
+}
+
+/*Give a newly seen device its remembered name and mapping.
+ *The remembered slot is used later, in auto_assign_slot.
+ */
+int registry_restore_device(struct wiimoteglue_state *state, struct wii_device *dev) {
+  struct registry_entry *entry = registry_lookup(state,dev->bluetooth_addr);
+  if (entry == NULL)
+    return 0;
+
+  if (entry->id[0] != '\0') {
+    if (lookup_device(&state->dev_list,entry->id) == NULL) {
+      strncpy(dev->id,entry->id,WG_MAX_NAME_SIZE);
+    } else {
+      printf("Remembered name %s is already taken.\n",entry->id);
+    }
+  }
+
+  if (entry->has_tare) {
+    memcpy(dev->balance.tare,entry->tare,sizeof(dev->balance.tare));
+    dev->balance.has_tare = 1;
+  }
+
+  if (entry->mapping_name[0] != '\0') {
+    struct mode_mappings *maps = lookup_mappings(state,entry->mapping_name);
+    if (maps != NULL) {
+      set_device_specific_mappings(dev,maps);
+    } else {
+      printf("Remembered mapping \"%s\" for %s does not exist yet; it will be used once created.\n",entry->mapping_name,dev->id);
+    }
+  }
+
+  return 0;
+}
+
+struct virtual_controller* registry_preferred_slot(struct wiimoteglue_state *state, struct wii_device *dev) {
+  struct registry_entry *entry = registry_lookup(state,dev->bluetooth_addr);
+  if (entry == NULL || entry->slot_name[0] == '\0')
+    return NULL;
+
+  return lookup_slot(state,entry->slot_name);
+}
+
+int wiimoteglue_registry_close(struct wiimoteglue_state *state) {
+  int i;
+  for (i = 0; i < REGISTRY_BUCKETS; i++) {
+    struct registry_entry *entry = state->registry[i];
+    while (entry != NULL) {
+      struct registry_entry *next = entry->next;
+      free(entry);
+      entry = next;
+    }
+    state->registry[i] = NULL;
+  }
+  return 0;
+}
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "wiimoteglue.h"
+
+/* Axis response curves: deadzone, anti-deadzone,
+ * saturation, and an exponent or custom shape,
+ * plus optional smoothing ahead of the curve.
+ *
+ * Each distinct curve is worked out once, into a table
+ * with an entry for every 16 output units, so handling an
+ * event is a single table index with no floating point.
+ * Axes with identical settings share a curve, and curves
+ * differing only in smoothing share a table.
+ * Curve 0 means "no curve" and skips the table entirely.
+ *
+ * Each axis holding a curve holds a reference to it (see
+ * mapping_data_curves() in control_mappings.c). A curve
+ * nothing refers to stays around in case it's wanted
+ * again, until its spot is needed for a new one.
+ */
+
+#define RESPONSE_SHIFT 4
+#define RESPONSE_TABLE_SIZE (65536 >> RESPONSE_SHIFT)
+#define MAX_RESPONSE_CURVES 64
+
+struct response_table {
+  struct response_params shape; /*with smoothing left at the defaults*/
+  int refs; /*curves using it*/
+  int16_t table[RESPONSE_TABLE_SIZE];
+};
+
+struct axis_response {
+  struct response_params params;
+  int refs; /*axes using it*/
+  struct response_table *table; /*NULL if only smoothing*/
+};
+
+static struct axis_response *curves[MAX_RESPONSE_CURVES];
+static struct response_table *tables[MAX_RESPONSE_CURVES];
+
+void response_default_params(struct response_params *params) {
+  /*Zero everything, padding included, so
+   *params can be compared with memcmp.
+   */
+  memset(params,0,sizeof(*params));
+  params->saturation = 1;
+  params->exponent = 1;
+  params->smooth_beta = 2;
+}
+
+/*Maps a deflection from 0 to 1 onto an output from 0 to 1.*/
+static float response_shape(struct response_params *params, float x) {
+  if (x <= params->deadzone)
+    return 0;
+
+  float t = 1;
+  if (params->saturation > params->deadzone)
+    t = (x - params->deadzone) / (params->saturation - params->deadzone);
+  if (t > 1)
+    t = 1;
+
+  float shaped;
+  if (params->custom_count >= 2) {
+    /*Evenly spaced points, linearly interpolated.*/
+    float pos = t * (params->custom_count - 1);
+    int i = (int) pos;
+    if (i > params->custom_count - 2)
+      i = params->custom_count - 2;
+    shaped = params->custom[i] + (params->custom[i+1] - params->custom[i]) * (pos - i);
+  } else {
+    shaped = powf(t, params->exponent);
+  }
+
+  return params->antideadzone + (1 - params->antideadzone) * shaped;
+}
+
+static void response_build(struct response_table *response) {
+  int i;
+  for (i = 0; i < RESPONSE_TABLE_SIZE; i++) {
+    /*Use the end of this entry's range furthest from center,
+     *so a full deflection still gives a full output.
+     */
+    int in = (i << RESPONSE_SHIFT) - 32768;
+    if (in >= 0)
+      in += (1 << RESPONSE_SHIFT) - 1;
+    float x = abs(in) / (float) ABS_LIMIT;
+    if (x > 1)
+      x = 1;
+
+    int out = (int) lroundf(response_shape(&response->shape,x) * ABS_LIMIT);
+    if (out > ABS_LIMIT)
+      out = ABS_LIMIT; /*the table is only int16_t*/
+    if (out < 0)
+      out = 0;
+    response->table[i] = (in < 0) ? -out : out;
+  }
+}
+
+static void response_table_release(struct response_table *table) {
+  int i;
+  if (table == NULL || --table->refs > 0)
+    return;
+  for (i = 0; i < MAX_RESPONSE_CURVES; i++) {
+    if (tables[i] == table)
+      tables[i] = NULL;
+  }
+  free(table);
+}
+
+/*Find or build the table for the shape of a curve.
+ *Returns NULL for a straight line.
+ */
+static struct response_table* response_table_get(struct response_params *params, int *failed) {
+  struct response_params shape = *params;
+  struct response_params identity;
+  response_default_params(&identity);
+  shape.smooth_cutoff = identity.smooth_cutoff;
+  shape.smooth_beta = identity.smooth_beta;
+  *failed = 0;
+  if (memcmp(&shape,&identity,sizeof(identity)) == 0)
+    return NULL;
+
+  int i;
+  int free_slot = -1;
+  for (i = 0; i < MAX_RESPONSE_CURVES; i++) {
+    if (tables[i] == NULL) {
+      if (free_slot < 0)
+        free_slot = i;
+      continue;
+    }
+    if (memcmp(&tables[i]->shape,&shape,sizeof(shape)) == 0) {
+      tables[i]->refs++;
+      return tables[i];
+    }
+  }
+
+  /*There's never more tables than curves.*/
+  struct response_table *table = (free_slot < 0) ? NULL : malloc(sizeof(struct response_table));
+  if (table == NULL) {
+    *failed = 1;
+    return NULL;
+  }
+  table->shape = shape;
+  table->refs = 1;
+  response_build(table);
+  tables[free_slot] = table;
+  return table;
+}
+
+/*Find or build the curve for these parameters, and take a
+ *reference to it. Returns -1 if there are too many different
+ *curves in use.
+ */
+int response_curve_get(struct response_params *params) {
+  struct response_params identity;
+  response_default_params(&identity);
+  if (memcmp(params,&identity,sizeof(identity)) == 0)
+    return 0;
+
+  int i;
+  int free_slot = -1;
+  int unused_slot = -1;
+  for (i = 1; i < MAX_RESPONSE_CURVES; i++) {
+    if (curves[i] == NULL) {
+      if (free_slot < 0)
+        free_slot = i;
+      continue;
+    }
+    if (memcmp(&curves[i]->params,params,sizeof(*params)) == 0) {
+      curves[i]->refs++;
+      return i;
+    }
+    if (curves[i]->refs <= 0 && unused_slot < 0)
+      unused_slot = i;
+  }
+
+  if (free_slot < 0 && unused_slot >= 0) {
+    /*Make room by dropping a curve nothing uses.*/
+    response_table_release(curves[unused_slot]->table);
+    free(curves[unused_slot]);
+    curves[unused_slot] = NULL;
+    free_slot = unused_slot;
+  }
+  if (free_slot < 0) {
+    printf("Too many different response curves (the limit is %d).\n",MAX_RESPONSE_CURVES-1);
+    return -1;
+  }
+
+  struct axis_response *response = malloc(sizeof(struct axis_response));
+  if (response == NULL)
+    return -1;
+  int failed;
+  response->table = response_table_get(params,&failed);
+  if (failed) {
+    free(response);
+    return -1;
+  }
+  response->params = *params;
+  response->refs = 1;
+  curves[free_slot] = response;
+  return free_slot;
+}
+
+void response_curve_ref(int curve) {
+  if (curve > 0 && curve < MAX_RESPONSE_CURVES && curves[curve] != NULL)
+    curves[curve]->refs++;
+}
+
+void response_curve_unref(int curve) {
+  if (curve > 0 && curve < MAX_RESPONSE_CURVES && curves[curve] != NULL)
+    curves[curve]->refs--;
+}
+
+struct response_params* response_curve_params(int curve) {
+  if (curve <= 0 || curve >= MAX_RESPONSE_CURVES || curves[curve] == NULL)
+    return NULL;
+  return &curves[curve]->params;
+}
+
+int response_apply(int curve, int value) {
+  if (curve <= 0 || curve >= MAX_RESPONSE_CURVES || curves[curve] == NULL
+      || curves[curve]->table == NULL)
+    return value;
+
+  if (value > 32767)
+    value = 32767;
+  if (value < -32768)
+    value = -32768;
+
+  return curves[curve]->table->table[(value + 32768) >> RESPONSE_SHIFT];
+}
+
+/* The one-euro filter: a low-pass filter whose cutoff
+ * rises with the speed of the input. Held still, a low
+ * cutoff removes jitter; moving quickly, a high cutoff
+ * keeps the lag down. It needs only a couple of values
+ * of state per axis.
+ * See Casiez, Roussel, and Vogel, CHI 2012.
+ */
+
+#define EURO_SPEED_CUTOFF 1.0f /*Hz, for smoothing the speed itself*/
+#define EURO_MAX_GAP 0.5f /*seconds; start over after longer pauses*/
+
+static float euro_alpha(float cutoff, float dt) {
+  float tau = 1 / (2 * M_PI * cutoff);
+  return 1 / (1 + tau / dt);
+}
+
+int response_smooth(int curve, struct euro_state *filter, int value, struct timeval *time) {
+  struct response_params *params = response_curve_params(curve);
+  if (params == NULL || params->smooth_cutoff <= 0)
+    return value;
+
+  float x = value / (float) ABS_LIMIT;
+  float dt = (time->tv_sec - filter->last.tv_sec)
+    + (time->tv_usec - filter->last.tv_usec) / 1000000.0f;
+  filter->last = *time;
+
+  if (!filter->primed || dt > EURO_MAX_GAP || dt < 0) {
+    filter->value = x;
+    filter->speed = 0;
+    filter->primed = 1;
+    return value;
+  }
+  if (dt == 0)
+    return (int)(filter->value * ABS_LIMIT);
+
+  float speed = (x - filter->value) / dt;
+  filter->speed += euro_alpha(EURO_SPEED_CUTOFF,dt) * (speed - filter->speed);
+
+  float cutoff = params->smooth_cutoff + params->smooth_beta * fabsf(filter->speed);
+  filter->value += euro_alpha(cutoff,dt) * (x - filter->value);
+
+  return (int)(filter->value * ABS_LIMIT);
+}
+
+void response_curves_free() {
+  int i;
+  for (i = 0; i < MAX_RESPONSE_CURVES; i++) {
+    free(curves[i]);
+    curves[i] = NULL;
+    free(tables[i]);
+    tables[i] = NULL;
+  }
+}
@@ -6,7 +6,10 @@
  *the virtual controller slots.
  */
 
-#define NUM_SLOT_PATTERNS 9
+/*Slots past the end of the table wrap around to
+ *the start, so slot 13 lights up like slot 1.
+ */
+#define NUM_SLOT_PATTERNS 12
 bool slot_leds[NUM_SLOT_PATTERNS+1][4] = {
   {0,1,1,0}, /*keyboardmouse slot*/
   {1,0,0,0}, /*slot 1... etc. */
@@ -17,38 +20,111 @@ bool slot_leds[NUM_SLOT_PATTERNS+1][4] = {
   {0,1,0,1},
   {0,0,1,1},
   {1,0,1,1},
-  {0,1,1,1}
+  {0,1,1,1},
+  {1,1,0,0},
+  {1,1,1,0},
+  {1,1,0,1}
 };
 
 
 bool no_slot_leds[4] = {1,0,1,0};
-bool slot_overflow_leds[4] = {1,1,1,1};
 
-struct virtual_controller* find_open_wiimote_slot(struct wiimoteglue_state *state) {
+/* Open slots are tracked in two bitmaps, one for remotes
+ * and one for boards, with bit n set while slot n has
+ * room. Finding an open slot is a scan for the first set
+ * bit, a word at a time.
+ */
+
+int slot_allocator_init(struct wiimoteglue_state *state) {
+  struct slot_allocator *alloc = &state->slot_alloc;
   int i;
-  for (i = 1; i <= state->num_slots; i++) {
-    if (state->slots[i].has_wiimote == 0) {
-      return &state->slots[i];
-    }
-  }
-  return NULL;
+  memset(alloc->free_remote,0,sizeof(alloc->free_remote));
+  memset(alloc->free_board,0,sizeof(alloc->free_board));
+  for (i = 1; i <= state->num_slots; i++)
+    slot_update_free(state,&state->slots[i]);
+  alloc->next = 1;
+  return 0;
 }
 
-struct virtual_controller* find_open_board_slot(struct wiimoteglue_state *state) {
-  int i;
-  for (i = 1; i <= state->num_slots; i++) {
-    if (state->slots[i].has_board == 0) {
-      return &state->slots[i];
-    }
+/*Call whenever a slot's has_wiimote or has_board changes.*/
+void slot_update_free(struct wiimoteglue_state *state, struct virtual_controller *slot) {
+  struct slot_allocator *alloc = &state->slot_alloc;
+  int num = slot->slot_number;
+  uint64_t bit = 1ULL << (num % 64);
+  if (num <= 0)
+    return; /*The keyboardmouse slot is never handed out on its own.*/
+
+  if (slot->has_wiimote == 0)
+    alloc->free_remote[num/64] |= bit;
+  else
+    alloc->free_remote[num/64] &= ~bit;
+
+  if (slot->has_board == 0)
+    alloc->free_board[num/64] |= bit;
+  else
+    alloc->free_board[num/64] &= ~bit;
+}
+
+/*First set bit at or after start, or 0 if there is none.*/
+static int first_free(uint64_t map[], int start) {
+  int word = start / 64;
+  uint64_t bits = map[word] & (~0ULL << (start % 64));
+  while (1) {
+    if (bits)
+      return word * 64 + __builtin_ctzll(bits);
+    if (++word >= SLOT_WORDS)
+      return 0;
+    bits = map[word];
   }
-  return NULL;
 }
 
 struct virtual_controller* find_open_slot(struct wiimoteglue_state *state, int dev_type) {
+  struct slot_allocator *alloc = &state->slot_alloc;
+  uint64_t *map = (dev_type == BALANCE) ? alloc->free_board : alloc->free_remote;
+  int num;
+
+  if (alloc->policy == SLOT_ROUND_ROBIN) {
+    /*Pick up after the last slot handed out, wrapping around.*/
+    num = first_free(map,alloc->next);
+    if (num == 0 || num > state->num_slots)
+      num = first_free(map,1);
+  } else {
+    num = first_free(map,1);
+  }
+
+  if (num == 0 || num > state->num_slots)
+    return NULL;
+
+  alloc->next = (num < state->num_slots) ? num + 1 : 1;
+  return &state->slots[num];
+}
+
+int slot_has_room(struct virtual_controller *slot, int dev_type) {
+  if (slot->slot_number == 0)
+    return 1; /*The keyboardmouse slot takes any number of devices.*/
   if (dev_type == BALANCE)
-    return find_open_board_slot(state);
+    return slot->has_board == 0;
+  return slot->has_wiimote == 0;
+}
+
+char* slot_policy_name(int policy) {
+  switch (policy) {
+  case SLOT_LOWEST: return "lowest";
+  case SLOT_ROUND_ROBIN: return "round-robin";
+  }
+  return "sticky";
+}
 
-  return find_open_wiimote_slot(state);
+int slot_policy_lookup(char *name) {
+  if (name == NULL)
+    return -1;
+  if (strcmp(name,"sticky") == 0)
+    return SLOT_STICKY;
+  if (strcmp(name,"lowest") == 0)
+    return SLOT_LOWEST;
+  if (strcmp(name,"round-robin") == 0)
+    return SLOT_ROUND_ROBIN;
+  return -1;
 }
 
 int add_device_to_slot(struct wiimoteglue_state* state, struct wii_device *dev, struct virtual_controller *slot) {
@@ -79,6 +155,7 @@ int add_device_to_slot(struct wiimoteglue_state* state, struct wii_device *dev,
   slot->dev_list.next = dev->slot_list;
 
   dev->slot = slot;
+  slot_merge_join(slot,dev);
 
 
 
@@ -87,6 +164,7 @@ int add_device_to_slot(struct wiimoteglue_state* state, struct wii_device *dev,
   } else {
     slot->has_wiimote++;
   }
+  slot_update_free(state,slot);
 
 
 
@@ -97,11 +175,8 @@ int add_device_to_slot(struct wiimoteglue_state* state, struct wii_device *dev,
     /*Keyboard/mouse slot. Let's just set a distinctive pattern.*/
    ret = set_led_state(state,dev,slot_leds[0]);
 
-  } else if (num > NUM_SLOT_PATTERNS) {
-    /*Future work: add some reasonable patterns here for higher nums?*/
-    ret = set_led_state(state,dev,slot_overflow_leds);
   } else {
-    ret = set_led_state(state,dev,&slot_leds[num]);
+    ret = set_led_state(state,dev,slot_leds[(num - 1) % NUM_SLOT_PATTERNS + 1]);
   }
 
   if (ret < 0 && ret != -2)
@@ -114,7 +189,8 @@ int add_device_to_slot(struct wiimoteglue_state* state, struct wii_device *dev,
   return 0;
 }
 
-int remove_device_from_slot(struct wii_device *dev) {
+int remove_device_from_slot(struct wiimoteglue_state* state, struct wii_device *dev) {
+  int i;
   if (dev == NULL) {
     return -1;
   }
@@ -140,7 +216,25 @@ int remove_device_from_slot(struct wii_device *dev) {
   } else {
     dev->slot->has_wiimote--;
   }
-
+  slot_update_free(state,dev->slot);
+
+  /*Don't leave the mouse drifting off on its own,
+   *or any turbo buttons going, or anything this
+   *device was holding down or pushing on. The
+   *releases all go out together as one frame.
+   *Buttons still held stay quiet until released.
+   *The slot's other devices keep their motion;
+   *only an unmerged device stops the whole mouse,
+   *since it was setting the velocity outright.
+   */
+  if (dev->merge_index < 0)
+    mouse_stop_slot(dev->slot);
+  turbo_stop_device(dev);
+  waggle_stop_device(dev);
+  axis_keys_release(dev);
+  slot_merge_leave(dev);
+  for (i = 0; i < XWII_KEY_NUM; i++)
+    dev->key_output[i] = NO_MAP;
 
   dev->slot = NULL;
 
@@ -149,7 +243,7 @@ int remove_device_from_slot(struct wii_device *dev) {
   return 0;
 }
 
-int change_slot_type(struct wiimoteglue_state* state, struct virtual_controller *slot,int type) {
+int change_slot_type(struct wiimoteglue_state* state, struct virtual_controller *slot, enum SLOT_TYPE type) {
   if (slot == NULL)
     return -1;
   if (slot->slot_number == 0) {
@@ -159,6 +253,10 @@ int change_slot_type(struct wiimoteglue_state* state, struct virtual_controller
      */
   }
 
+  /*Let go of everything on the old virtual device.*/
+  if (type != slot->type)
+    slot_merge_clear(slot);
+
   if (type == SLOT_GAMEPAD) {
     slot->uinput_fd = slot->gamepad_fd;
     slot->type = SLOT_GAMEPAD;
@@ -169,7 +267,7 @@ int change_slot_type(struct wiimoteglue_state* state, struct virtual_controller
      */
     if (slot->slot_specific_mappings == state->slots[0].slot_specific_mappings) {
       printf("Switched slot's mapping to the gamepad mapping.\n");
-      slot->slot_specific_mappings = NULL;
+      set_slot_specific_mappings(slot,NULL);
     }
     return 0;
   }
@@ -180,7 +278,7 @@ int change_slot_type(struct wiimoteglue_state* state, struct virtual_controller
     /*If no specific map set, go ahead and use the keyboardmouse one.*/
     if (slot->slot_specific_mappings == NULL) {
       printf("Switched slot's mapping to the keyboardmouse mapping.\n");
-      slot->slot_specific_mappings = state->slots[0].slot_specific_mappings;
+      set_slot_specific_mappings(slot,state->slots[0].slot_specific_mappings);
     }
     return 0;
   }
@@ -198,13 +296,17 @@ int set_slot_specific_mappings(struct virtual_controller *slot, struct mode_mapp
     return -2;
 
 
-  if (slot->slot_specific_mappings != NULL)
+  if (slot->slot_specific_mappings != NULL) {
+    mappings_remove_slot_user(slot->slot_specific_mappings,slot);
     mappings_unref(slot->slot_specific_mappings);
+  }
 
   slot->slot_specific_mappings = maps;
 
-  if (maps != NULL)
+  if (maps != NULL) {
     mappings_ref(maps);
+    mappings_add_slot_user(maps,slot);
+  }
 
   return 0;
 
@@ -0,0 +1,342 @@
+#include <sys/timerfd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wiimoteglue.h"
+
+/* Timers for turbo buttons, macros, and the mouse.
+ *
+ * Every timer shares one timerfd in the epoll loop;
+ * nothing ever sleeps. Pending timers hang off a two
+ * level timer wheel: an inner wheel of 1ms buckets for
+ * the next quarter second or so, and an outer wheel with
+ * a bucket per turn of the inner wheel, for the next
+ * 16 seconds. Each turn, the next outer bucket is
+ * spread out over the inner wheel. Timers any further
+ * out wait in the last outer bucket until it comes around.
+ *
+ * Adding or cancelling a timer is just a list insert or
+ * removal, so it doesn't matter how many are running,
+ * and the timerfd is only set for the next bucket that
+ * has anything in it.
+ *
+ * Timers are embedded in whatever owns them;
+ * nothing here is allocated.
+ */
+
+#define TICK_NS 1000000ULL
+#define NS_PER_SEC 1000000000ULL
+
+uint64_t timer_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void list_init(struct wg_timer *head) {
+  head->next = head;
+  head->prev = head;
+}
+
+static int list_empty(struct wg_timer *head) {
+  return head->next == head;
+}
+
+static void list_append(struct wg_timer *head, struct wg_timer *timer) {
+  timer->prev = head->prev;
+  timer->next = head;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+static void list_remove(struct wg_timer *timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = NULL;
+  timer->prev = NULL;
+}
+
+int wiimoteglue_timers_init(struct wiimoteglue_state *state) {
+  struct timer_wheel *wheel = &state->timers;
+  int i;
+
+  memset(wheel,0,sizeof(*wheel));
+  wheel->state = state;
+  for (i = 0; i < WHEEL_SIZE; i++)
+    list_init(&wheel->inner[i]);
+  for (i = 0; i < WHEEL_OUTER_SIZE; i++)
+    list_init(&wheel->outer[i]);
+  wheel->tick = timer_now() / TICK_NS;
+
+  wheel->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (wheel->fd < 0) {
+    perror("timerfd_create");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*Put a timer in its bucket. Timers due before
+ *the earliest tick go in that tick's bucket.
+ */
+static void wheel_place(struct timer_wheel *wheel, struct wg_timer *timer, uint64_t earliest) {
+  /*Round up; a timer should never fire early.*/
+  uint64_t tick = (timer->expires + TICK_NS - 1) / TICK_NS;
+  if (tick < earliest)
+    tick = earliest;
+
+  if (tick - wheel->tick < WHEEL_SIZE) {
+    int i = tick & (WHEEL_SIZE - 1);
+    list_append(&wheel->inner[i],timer);
+    wheel->inner_used[i/64] |= 1ULL << (i%64);
+    return;
+  }
+
+  uint64_t turn = tick >> WHEEL_BITS;
+  uint64_t current = wheel->tick >> WHEEL_BITS;
+  if (turn - current >= WHEEL_OUTER_SIZE)
+    turn = current + WHEEL_OUTER_SIZE - 1;
+
+  int i = turn & (WHEEL_OUTER_SIZE - 1);
+  list_append(&wheel->outer[i],timer);
+  wheel->outer_used |= 1ULL << i;
+}
+
+int timer_schedule(struct timer_wheel *wheel, struct wg_timer *timer, uint64_t expires) {
+  if (wheel->fd < 0)
+    return -1;
+
+  timer_cancel(timer);
+
+  /*After sitting idle, our idea of the current tick
+   *is out of date. Catch it up before using it.
+   */
+  if (wheel->count == 0 && !wheel->running)
+    wheel->tick = timer_now() / TICK_NS;
+
+  timer->expires = expires;
+  timer->wheel = wheel;
+  wheel->count++;
+  wheel_place(wheel,timer,wheel->tick + 1);
+
+  if (!wheel->running) {
+    uint64_t tick = (expires + TICK_NS - 1) / TICK_NS;
+    if (wheel->armed == 0 || tick < wheel->armed) {
+      /*This is now the first timer due.*/
+      struct itimerspec spec;
+      memset(&spec,0,sizeof(spec));
+      if (tick <= wheel->tick)
+        tick = wheel->tick + 1;
+      spec.it_value.tv_sec = tick * TICK_NS / NS_PER_SEC;
+      spec.it_value.tv_nsec = tick * TICK_NS % NS_PER_SEC;
+      timerfd_settime(wheel->fd,TFD_TIMER_ABSTIME,&spec,NULL);
+      wheel->armed = tick;
+    }
+  }
+  return 0;
+}
+
+int timer_start(struct timer_wheel *wheel, struct wg_timer *timer, uint64_t delay) {
+  return timer_schedule(wheel,timer,timer_now() + delay);
+}
+
+/*Cancelled timers just leave their bucket. Its
+ *used bit is cleared next time we look at it.
+ */
+void timer_cancel(struct wg_timer *timer) {
+  if (timer->wheel == NULL)
+    return;
+  list_remove(timer);
+  timer->wheel->count--;
+  timer->wheel = NULL;
+}
+
+int timer_pending(struct wg_timer *timer) {
+  return timer->wheel != NULL;
+}
+
+static int inner_used(struct timer_wheel *wheel) {
+  int i;
+  for (i = 0; i < WHEEL_SIZE/64; i++) {
+    if (wheel->inner_used[i])
+      return 1;
+  }
+  return 0;
+}
+
+/*Spread the timers in the outer bucket for
+ *this turn over the inner wheel.
+ */
+static void wheel_cascade(struct timer_wheel *wheel) {
+  int i = (wheel->tick >> WHEEL_BITS) & (WHEEL_OUTER_SIZE - 1);
+  struct wg_timer *bucket = &wheel->outer[i];
+  struct wg_timer pending;
+
+  wheel->outer_used &= ~(1ULL << i);
+  if (list_empty(bucket))
+    return;
+
+  /*Move them aside first, since ones that are
+   *still too far out land back in this bucket.
+   */
+  list_init(&pending);
+  while (!list_empty(bucket)) {
+    struct wg_timer *timer = bucket->next;
+    list_remove(timer);
+    list_append(&pending,timer);
+  }
+  while (!list_empty(&pending)) {
+    struct wg_timer *timer = pending.next;
+    list_remove(timer);
+    wheel_place(wheel,timer,wheel->tick);
+  }
+}
+
+static void wheel_fire(struct timer_wheel *wheel, int i) {
+  struct wg_timer *bucket = &wheel->inner[i];
+  struct wg_timer due;
+
+  wheel->inner_used[i/64] &= ~(1ULL << (i%64));
+  if (list_empty(bucket))
+    return;
+
+  /*Anything a timer schedules from here goes
+   *in a later bucket, never this one.
+   */
+  list_init(&due);
+  while (!list_empty(bucket)) {
+    struct wg_timer *timer = bucket->next;
+    list_remove(timer);
+    list_append(&due,timer);
+  }
+
+  /*Take them one at a time, in case firing
+   *one cancels another.
+   */
+  while (!list_empty(&due)) {
+    struct wg_timer *timer = due.next;
+    list_remove(timer);
+    timer->wheel = NULL;
+    wheel->count--;
+
+    uint64_t late = (wheel->now > timer->expires) ? wheel->now - timer->expires : 0;
+    wheel->fired++;
+    wheel->late_total += late;
+    if (late > wheel->late_max)
+      wheel->late_max = late;
+
+    timer->fire(wheel->state,timer);
+  }
+}
+
+static void wheel_advance(struct timer_wheel *wheel, uint64_t target) {
+  while (wheel->tick < target) {
+    if (wheel->count == 0) {
+      wheel->tick = target;
+      break;
+    }
+
+    if (inner_used(wheel)) {
+      wheel->tick++;
+    } else {
+      /*Nothing soon; skip ahead to the next turn.*/
+      uint64_t next_turn = (wheel->tick | (WHEEL_SIZE - 1)) + 1;
+      if (next_turn > target) {
+        wheel->tick = target;
+        break;
+      }
+      wheel->tick = next_turn;
+    }
+
+    if ((wheel->tick & (WHEEL_SIZE - 1)) == 0)
+      wheel_cascade(wheel);
+    wheel_fire(wheel,wheel->tick & (WHEEL_SIZE - 1));
+  }
+}
+
+/*Find the next tick worth waking up for: whichever comes
+ *first of the next non-empty inner bucket, and the start of
+ *the next turn with a non-empty outer bucket (its timers may
+ *be due before anything on the inner wheel). Returns 0 if
+ *nothing is pending.
+ */
+static uint64_t wheel_next_tick(struct timer_wheel *wheel) {
+  uint64_t next = 0;
+  uint64_t i;
+  if (wheel->count == 0)
+    return 0;
+
+  uint64_t turn = wheel->tick >> WHEEL_BITS;
+  for (i = 1; i < WHEEL_OUTER_SIZE; i++) {
+    int b = (turn + i) & (WHEEL_OUTER_SIZE - 1);
+    if (!(wheel->outer_used & (1ULL << b)))
+      continue;
+    if (!list_empty(&wheel->outer[b])) {
+      next = (turn + i) << WHEEL_BITS;
+      break;
+    }
+    wheel->outer_used &= ~(1ULL << b);
+  }
+
+  for (i = 1; i < WHEEL_SIZE; i++) {
+    uint64_t tick = wheel->tick + i;
+    if (next != 0 && tick >= next)
+      break;
+    int b = tick & (WHEEL_SIZE - 1);
+    if (!(wheel->inner_used[b/64] & (1ULL << (b%64))))
+      continue;
+    if (!list_empty(&wheel->inner[b]))
+      return tick;
+    wheel->inner_used[b/64] &= ~(1ULL << (b%64));
+  }
+
+  return next;
+}
+
+static void wheel_arm(struct timer_wheel *wheel) {
+  uint64_t next = wheel_next_tick(wheel);
+  if (next == wheel->armed)
+    return;
+
+  /*A zero it_value disarms it.*/
+  struct itimerspec spec;
+  memset(&spec,0,sizeof(spec));
+  if (next != 0) {
+    spec.it_value.tv_sec = next * TICK_NS / NS_PER_SEC;
+    spec.it_value.tv_nsec = next * TICK_NS % NS_PER_SEC;
+  }
+
+  if (timerfd_settime(wheel->fd,TFD_TIMER_ABSTIME,&spec,NULL) < 0) {
+    perror("timerfd_settime");
+    return;
+  }
+  wheel->armed = next;
+}
+
+int wiimoteglue_timers_handle_tick(struct wiimoteglue_state *state) {
+  struct timer_wheel *wheel = &state->timers;
+  uint64_t expirations;
+
+  /*Just to clear it; the clock says what's due.*/
+  read(wheel->fd,&expirations,sizeof(expirations));
+  wheel->armed = 0;
+
+  wheel->now = timer_now();
+  wheel->running = 1;
+  wheel_advance(wheel,wheel->now / TICK_NS);
+  wheel->running = 0;
+
+  wheel_arm(wheel);
+  return 0;
+}
+
+int wiimoteglue_timers_close(struct wiimoteglue_state *state) {
+  if (state->timers.fd >= 0)
+    close(state->timers.fd);
+  state->timers.fd = -1;
+  return 0;
+}
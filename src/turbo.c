@@ -0,0 +1,331 @@
+#include <linux/input.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wiimoteglue.h"
+
+/* Turbo buttons and macros.
+ *
+ * A turbo button presses and releases its output over
+ * and over for as long as it is held. A macro is a short
+ * list of output key presses, releases, and pauses, played
+ * back when its button is pressed (and looped while it is
+ * held, if asked).
+ *
+ * Each button of each device has a player for this,
+ * driven by the timer wheel in timers.c.
+ */
+
+#define MACRO_TAP_MS 30 /*how long a tapped key is held, and the pause after*/
+#define NS_PER_MS 1000000ULL
+#define NS_PER_SEC 1000000000ULL
+#define MACRO_TEXT_SIZE 256
+
+struct macro_step {
+  int code;
+  int value; /*1 to press, 0 to release*/
+  int delay; /*ms to wait afterwards*/
+};
+
+struct macro {
+  char name[WG_MAX_NAME_SIZE];
+  char text[MACRO_TEXT_SIZE]; /*as entered, for listing*/
+  int num_steps;
+  struct macro_step steps[MAX_MACRO_STEPS];
+};
+
+static struct macro *macros[MAX_MACROS];
+
+static void write_key(struct wii_device *dev, int code, int value) {
+  slot_merge_key(dev, code, value);
+  slot_merge_flush(dev->slot);
+}
+
+/*Half a press-and-release cycle.*/
+static uint64_t turbo_period(int rate) {
+  return NS_PER_SEC / (2 * rate);
+}
+
+/*Let go of every key this macro presses,
+ *in case it was cut off partway.
+ */
+static void macro_release(struct wii_device *dev, struct macro *macro) {
+  int i;
+  for (i = 0; i < macro->num_steps; i++) {
+    if (macro->steps[i].value)
+      slot_merge_key(dev,macro->steps[i].code,0);
+  }
+}
+
+/*Play steps until one calls for a pause, then
+ *wait for the timer to pick up where it left off.
+ */
+static void macro_continue(struct wiimoteglue_state *state, struct button_player *player, uint64_t now) {
+  struct macro *macro = macros[player->code & ~WG_MACRO];
+  struct wii_device *dev = player->dev;
+
+  if (macro == NULL || dev->slot == NULL)
+    return;
+
+  /*A SYN after every step, so a press and release
+   *of the same key aren't seen as one frame.
+   */
+  while (player->step < macro->num_steps) {
+    struct macro_step *step = &macro->steps[player->step++];
+    write_key(dev,step->code,step->value);
+
+    if (step->delay > 0) {
+      timer_schedule(&state->timers,&player->timer,now + step->delay * NS_PER_MS);
+      return;
+    }
+  }
+
+  /*Done. Go again if it loops and is still held,
+   *with a short pause if it doesn't end with one.
+   */
+  if (player->rate && player->held) {
+    uint64_t pause = 0;
+    if (macro->num_steps == 0 || macro->steps[macro->num_steps-1].delay == 0)
+      pause = MACRO_TAP_MS * NS_PER_MS;
+    player->step = 0;
+    timer_schedule(&state->timers,&player->timer,now + pause);
+  }
+}
+
+static void player_fire(struct wiimoteglue_state *state, struct wg_timer *timer) {
+  struct button_player *player = timer->data;
+  struct virtual_controller *slot = player->dev->slot;
+  if (slot == NULL)
+    return;
+
+  if (player->code & WG_MACRO) {
+    macro_continue(state,player,timer->expires);
+    return;
+  }
+
+  player->down = !player->down;
+  write_key(player->dev,player->code,player->down);
+
+  /*Stay on the original schedule so the rate doesn't
+   *drift, unless we've fallen a whole period behind.
+   */
+  uint64_t period = turbo_period(player->rate);
+  uint64_t next = timer->expires + period;
+  if (next <= state->timers.now)
+    next = state->timers.now + period;
+  timer_schedule(&state->timers,timer,next);
+}
+
+/*Returns 1 if the button is a turbo button or macro
+ *and has been taken care of, 0 if it's a plain button.
+ */
+int turbo_press(struct wiimoteglue_state *state, struct wii_device *dev, struct event_map *map, int button) {
+  struct button_player *player = &dev->players[button];
+  int code = map->button_map[button];
+  int rate = map->button_turbo[button];
+
+  if (player->held)
+    return 1; /*auto-repeat*/
+  if (code == NO_MAP || dev->slot == NULL)
+    return 0;
+  if (!(code & WG_MACRO) && rate <= 0)
+    return 0;
+
+  player->held = 1;
+
+  /*A macro still playing from the last press
+   *is left to finish.
+   */
+  if (timer_pending(&player->timer))
+    return 1;
+
+  player->timer.fire = player_fire;
+  player->timer.data = player;
+  player->dev = dev;
+  player->code = code;
+  player->rate = rate;
+  player->step = 0;
+
+  uint64_t now = timer_now();
+  if (code & WG_MACRO) {
+    macro_continue(state,player,now);
+    return 1;
+  }
+
+  player->down = 1;
+  write_key(dev,code,1);
+  timer_schedule(&state->timers,&player->timer,now + turbo_period(rate));
+  return 1;
+}
+
+int turbo_release(struct wii_device *dev, int button) {
+  struct button_player *player = &dev->players[button];
+  if (!player->held)
+    return 0;
+  player->held = 0;
+
+  /*Macros play out to the end; looping ones
+   *just don't start over.
+   */
+  if (player->code & WG_MACRO)
+    return 1;
+
+  timer_cancel(&player->timer);
+  if (player->down && dev->slot != NULL)
+    write_key(dev,player->code,0);
+  player->down = 0;
+  return 1;
+}
+
+/*Stop everything and let go of any keys, before the
+ *device leaves its slot. The releases are only queued;
+ *the caller sends them along with everything else.
+ */
+void turbo_stop_device(struct wii_device *dev) {
+  int i;
+  for (i = 0; i < XWII_KEY_NUM; i++) {
+    struct button_player *player = &dev->players[i];
+    int playing = timer_pending(&player->timer);
+    timer_cancel(&player->timer);
+
+    if (dev->slot != NULL) {
+      if (player->code & WG_MACRO) {
+        struct macro *macro = macros[player->code & ~WG_MACRO];
+        if ((playing || player->held) && macro != NULL)
+          macro_release(dev,macro);
+      } else if (player->down) {
+        slot_merge_key(dev,player->code,0);
+      }
+    }
+
+    player->held = 0;
+    player->down = 0;
+    player->step = 0;
+  }
+}
+
+int macro_lookup(char *name) {
+  int i;
+  if (name == NULL)
+    return -1;
+  for (i = 0; i < MAX_MACROS; i++) {
+    if (macros[i] != NULL && strcmp(macros[i]->name,name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+static int add_step(struct macro *macro, int code, int value, int delay) {
+  if (macro->num_steps >= MAX_MACRO_STEPS)
+    return -1;
+  struct macro_step *step = &macro->steps[macro->num_steps++];
+  step->code = code;
+  step->value = value;
+  step->delay = delay;
+  return 0;
+}
+
+/* Steps are output key names, each tapped in turn.
+ * "key_a+" only presses a key, and "key_a-" only releases it.
+ * A number pauses for that many milliseconds.
+ * Redefining a macro changes it for every button it's mapped to.
+ */
+int macro_define(char *name, char *steps[]) {
+  struct macro macro;
+  int i;
+
+  if (name == NULL || steps[0] == NULL) {
+    printf("usage: macro <name> <step> [step] ...\n");
+    printf("Each step is an output key to tap, a key followed by + or - to\n");
+    printf("only press or release it, or a number of milliseconds to pause.\n");
+    return -1;
+  }
+
+  memset(&macro,0,sizeof(macro));
+  strncpy(macro.name,name,WG_MAX_NAME_SIZE-1);
+
+  for (i = 0; steps[i] != NULL; i++) {
+    char *word = steps[i];
+
+    if (isdigit(word[0])) {
+      int delay = atoi(word);
+      if (macro.num_steps == 0) {
+        printf("A macro can't start with a pause.\n");
+        return -1;
+      }
+      macro.steps[macro.num_steps-1].delay += delay;
+    } else {
+      char key[WG_MAX_NAME_SIZE];
+      int value = -1; /*tap*/
+      int len = strlen(word);
+      strncpy(key,word,WG_MAX_NAME_SIZE-1);
+      key[WG_MAX_NAME_SIZE-1] = '\0';
+      if (len > 1 && len < WG_MAX_NAME_SIZE && (word[len-1] == '+' || word[len-1] == '-')) {
+        value = (word[len-1] == '+');
+        key[len-1] = '\0';
+      }
+
+      int code = get_output_key(key);
+      if (code == -2 || code == NO_MAP) {
+        printf("Output key \"%s\" not recognized. See \"events\" for valid values.\n",key);
+        return -1;
+      }
+
+      int ret;
+      if (value < 0) {
+        ret = add_step(&macro,code,1,MACRO_TAP_MS);
+        if (ret == 0)
+          ret = add_step(&macro,code,0,MACRO_TAP_MS);
+      } else {
+        ret = add_step(&macro,code,value,0);
+      }
+      if (ret < 0) {
+        printf("Macros are limited to %d presses and releases.\n",MAX_MACRO_STEPS);
+        return -1;
+      }
+    }
+
+    if (i > 0)
+      strncat(macro.text," ",MACRO_TEXT_SIZE - strlen(macro.text) - 1);
+    strncat(macro.text,word,MACRO_TEXT_SIZE - strlen(macro.text) - 1);
+  }
+
+  int index = macro_lookup(name);
+  if (index < 0) {
+    for (index = 0; index < MAX_MACROS && macros[index] != NULL; index++);
+    if (index == MAX_MACROS) {
+      printf("Too many macros (the limit is %d).\n",MAX_MACROS);
+      return -1;
+    }
+    macros[index] = malloc(sizeof(struct macro));
+    if (macros[index] == NULL)
+      return -1;
+  }
+
+  *macros[index] = macro;
+  return index;
+}
+
+int list_macros() {
+  int i;
+  int count = 0;
+  for (i = 0; i < MAX_MACROS; i++) {
+    if (macros[i] == NULL)
+      continue;
+    printf("- %s: %s\n",macros[i]->name,macros[i]->text);
+    count++;
+  }
+  if (count == 0)
+    printf("No macros have been defined.\n");
+  return 0;
+}
+
+void macros_free() {
+  int i;
+  for (i = 0; i < MAX_MACROS; i++) {
+    free(macros[i]);
+    macros[i] = NULL;
+  }
+}
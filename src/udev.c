@@ -109,7 +109,7 @@ int wiimoteglue_udev_handle_event(struct wiimoteglue_state *state) {
       char* syspath = udev_device_get_syspath(parentdev);
       struct wii_device *wiidev = lookup_syspath(&state->dev_list,syspath);
       if (wiidev != NULL)
-        wiimoteglue_update_extensions(state,wiidev);
+        wiimoteglue_queue_extension_update(state,wiidev);
     }
     
     if (strcmp(action,"remove") == 0) {
@@ -119,7 +119,7 @@ int wiimoteglue_udev_handle_event(struct wiimoteglue_state *state) {
         char* syspath = udev_device_get_syspath(parentdev);
         struct wii_device *wiidev = lookup_syspath(&state->dev_list,syspath);
         if (wiidev != NULL)
-          wiimoteglue_update_extensions(state,wiidev);
+          wiimoteglue_queue_extension_update(state,wiidev);
       }
       
       if (subsystem != NULL && strcmp(subsystem, "hid") == 0) {
@@ -127,7 +127,7 @@ int wiimoteglue_udev_handle_event(struct wiimoteglue_state *state) {
         char* syspath = udev_device_get_syspath(dev);
         struct wii_device *wiidev = lookup_syspath(&state->dev_list,syspath);
         if (wiidev != NULL) {
-          remove_device_from_slot(wiidev);
+          remove_device_from_slot(state,wiidev);
           udev_device_unref(wiidev->udev);
           wiidev->udev = NULL;
           printf("Device %s disconnected from system.\n",wiidev->id);
@@ -38,12 +38,17 @@ int wiimoteglue_uinput_init(int num_slots, struct virtual_controller slots[], ch
   if (keyboardmouse_fd < 0) {
     return -1;
   }
+  int mouse_fd = open_uinput_mouse_fd(uinput_path);
+  if (mouse_fd < 0) {
+    return -1;
+  }
 
 
 
   slots[0].uinput_fd = keyboardmouse_fd;
   slots[0].keyboardmouse_fd = slots[0].uinput_fd;
   slots[0].gamepad_fd = slots[0].uinput_fd;
+  slots[0].mouse_fd = mouse_fd;
   slots[0].has_wiimote = 0;
   slots[0].has_board = 0;
   slots[0].slot_number = 0;
@@ -62,6 +67,7 @@ int wiimoteglue_uinput_init(int num_slots, struct virtual_controller slots[], ch
     slots[i].uinput_fd = uinput_fd;
     slots[i].keyboardmouse_fd = keyboardmouse_fd;
     slots[i].gamepad_fd = uinput_fd;
+    slots[i].mouse_fd = mouse_fd;
     slots[i].slot_number = i;
     slots[i].has_wiimote = 0;
     slots[i].has_board = 0;
@@ -90,6 +96,12 @@ int wiimoteglue_uinput_close(int num_slots, struct virtual_controller slots[]) {
     close(slots[i].uinput_fd);
   }
 
+  /*Every slot shares the one relative mouse.*/
+  if (slots[0].mouse_fd > 0) {
+    ioctl(slots[0].mouse_fd, UI_DEV_DESTROY);
+    close(slots[0].mouse_fd);
+  }
+
   return 0;
 }
 
@@ -100,6 +112,7 @@ int open_uinput_gamepad_fd(char* uinput_path) {
    * So we just create a gamepad with all of them, even if unmapped.
    */
   static int abs[] = { ABS_X, ABS_Y, ABS_RX, ABS_RY};
+  static int triggers[] = { ABS_Z, ABS_RZ};
   static int key[] = { BTN_SOUTH, BTN_EAST, BTN_NORTH, BTN_WEST, BTN_SELECT, BTN_MODE, BTN_START, BTN_TL, BTN_TL2, BTN_TR, BTN_TR2, BTN_DPAD_DOWN, BTN_DPAD_LEFT, BTN_DPAD_RIGHT, BTN_DPAD_UP,BTN_THUMBL, BTN_THUMBR};
   struct uinput_user_dev uidev;
   int fd;
@@ -124,6 +137,13 @@ int open_uinput_gamepad_fd(char* uinput_path) {
     uidev.absmax[abs[i]] = 32768;
     uidev.absflat[abs[i]] = 4096;
   }
+  /*Analog triggers only go one way.*/
+  for (i = 0; i < 2; i++) {
+    ioctl(fd, UI_SET_ABSBIT, triggers[i]);
+    uidev.absmin[triggers[i]] = 0;
+    uidev.absmax[triggers[i]] = 32767;
+    uidev.absflat[triggers[i]] = 0;
+  }
 
   ioctl(fd, UI_SET_EVBIT, EV_KEY);
   for (i = 0; i < 17; i++) {
@@ -192,3 +212,47 @@ int open_uinput_keyboardmouse_fd(char* uinput_path) {
     perror("uinput device creation");
   return fd;
 }
+
+int open_uinput_mouse_fd(char* uinput_path) {
+  /* Relative motion gets its own device. The keyboard/mouse
+   * above reports absolute positions and looks like a tablet,
+   * so relative events sent there would just be ignored.
+   */
+  static int rel[] = { REL_X, REL_Y, REL_WHEEL, REL_HWHEEL};
+  static int key[] = { BTN_LEFT, BTN_MIDDLE, BTN_RIGHT};
+  struct uinput_user_dev uidev;
+  int fd;
+  int i;
+
+  fd = open(uinput_path, O_WRONLY | O_NONBLOCK);
+  if (fd < 0) {
+    perror("\nopen uinput");
+    return -1;
+  }
+  memset(&uidev, 0, sizeof(uidev));
+  snprintf(uidev.name, UINPUT_MAX_NAME_SIZE, "WiimoteGlue Virtual Mouse");
+  uidev.id.bustype = BUS_USB;
+  uidev.id.vendor = 0x1;
+  uidev.id.product = 0x1;
+  uidev.id.version = 1;
+
+  ioctl(fd, UI_SET_EVBIT, EV_REL);
+  for (i = 0; i < 4; i++) {
+    ioctl(fd, UI_SET_RELBIT, rel[i]);
+  }
+#ifdef REL_WHEEL_HI_RES
+  ioctl(fd, UI_SET_RELBIT, REL_WHEEL_HI_RES);
+  ioctl(fd, UI_SET_RELBIT, REL_HWHEEL_HI_RES);
+#endif
+
+  /*Mice need buttons to be recognized as mice.*/
+  ioctl(fd, UI_SET_EVBIT, EV_KEY);
+  for (i = 0; i < 3; i++) {
+    ioctl(fd, UI_SET_KEYBIT, key[i]);
+  }
+
+  write(fd, &uidev, sizeof(uidev));
+  if (ioctl(fd, UI_DEV_CREATE) < 0)
+    perror("uinput device creation");
+  return fd;
+}
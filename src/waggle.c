@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wiimoteglue.h"
+
+/* Detecting a shake ("waggle") of the wiimote or nunchuk.
+ *
+ * Each accelerometer sample is reduced to how far it is
+ * from plain gravity. A ring buffer keeps the last few of
+ * those with a running total, so the average over the
+ * window costs the same no matter how big it is.
+ * Shaking starts when the average climbs past the
+ * threshold, and stops once it falls below half of it,
+ * so noise right at the threshold doesn't flicker.
+ * After a shake, another can't start until the
+ * cooldown has passed.
+ */
+
+void waggle_reset(struct waggle_detector *waggle) {
+  memset(waggle,0,sizeof(*waggle));
+  waggle->code = NO_MAP;
+}
+
+/*Returns 1 when shaking starts, -1 when it stops, and 0 otherwise.*/
+int waggle_update(struct waggle_detector *waggle, struct xwii_event_abs *accel, int threshold, int cooldown, struct timeval *time) {
+  int x = accel->x;
+  int y = accel->y;
+  int z = accel->z;
+
+  /*|a|^2 - g^2 is about 2g(|a| - g) near 1g,
+   *and doesn't need a square root.
+   */
+  int deviation = abs(x*x + y*y + z*z - ACCEL_1G*ACCEL_1G) / (2*ACCEL_1G);
+
+  waggle->sum += deviation - waggle->history[waggle->pos];
+  waggle->history[waggle->pos] = deviation;
+  waggle->pos = (waggle->pos + 1) & (WAGGLE_WINDOW - 1);
+
+  int level = waggle->sum / WAGGLE_WINDOW;
+
+  if (waggle->active) {
+    if (level * 2 >= threshold)
+      return 0;
+    waggle->active = 0;
+    waggle->last = *time;
+    return -1;
+  }
+
+  if (level < threshold)
+    return 0;
+
+  long since = (time->tv_sec - waggle->last.tv_sec) * 1000
+    + (time->tv_usec - waggle->last.tv_usec) / 1000;
+  if (since >= 0 && since < cooldown)
+    return 0;
+
+  waggle->active = 1;
+  return 1;
+}
+
+/*Let go of a shake still in progress, before the
+ *device leaves its slot. Only queued, like turbo_stop_device.
+ */
+void waggle_stop_device(struct wii_device *dev) {
+  int i;
+  for (i = 0; i < 2; i++) {
+    struct waggle_detector *waggle = &dev->waggle[i];
+    if (waggle->active && waggle->code != NO_MAP && dev->slot != NULL)
+      slot_merge_key(dev, waggle->code, 0);
+    waggle_reset(waggle);
+  }
+}
@@ -1,6 +1,9 @@
 #ifndef WIIMOTEGLUE_H
 #define WIIMOTEGLUE_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/input.h>
 #include <xwiimote.h>
 #include <libudev.h>
 
@@ -14,8 +17,77 @@
 #define NUNCHUK_SCALE (ABS_LIMIT/NUNCHUK_LIMIT)
 #define CLASSIC_LIMIT 22
 #define CLASSIC_SCALE (ABS_LIMIT/CLASSIC_LIMIT)
+/*The original classic controller's analog triggers.
+ *They only go one way, from 0 up.
+ */
+#define TRIGGER_LIMIT 30
+#define TRIGGER_SCALE (ABS_LIMIT/TRIGGER_LIMIT)
+/*The Wii U Pro sticks reach about 1024.*/
+#define PRO_SCALE 32
+/*Motion Plus rates, after the kernel's slow/fast mode
+ *scaling, come out to roughly this many units per degree/second.
+ *Gyro axis scales are in output units per degree/second.
+ */
+#define MP_UNITS_PER_DEGREE 250
+#define GYRO_LIMIT 360
+#define GYRO_SCALE (ABS_LIMIT/GYRO_LIMIT)
+/*Orientation scales are output units per degree.*/
+#define ORIENT_SCALE (ABS_LIMIT/90)
+#define YAW_SCALE (ABS_LIMIT/180)
+/*Balance board sensors read in 10g units. The
+ *total weight is scaled so 150kg is a full deflection.
+ */
+#define WEIGHT_LIMIT 15000
+#define WEIGHT_SCALE (ABS_LIMIT/WEIGHT_LIMIT)
+/*Roughly 1g, in xwiimote accelerometer units.*/
+#define ACCEL_1G 100
 #define NO_MAP -1
 
+/*Output axis codes with this bit set are relative
+ *motion (REL_X etc.) on the virtual mouse instead.
+ *The mapped input axis becomes a mouse velocity.
+ */
+#define WG_REL_AXIS 0x100
+#define MOUSE_TICK_RATE 125 /*Hz*/
+
+/*Output button codes with this bit set play back
+ *a macro instead. The rest is the macro's number.
+ *See turbo.c
+ */
+#define WG_MACRO 0x1000
+#define MAX_MACROS 32
+#define MAX_MACRO_STEPS 32
+#define DEFAULT_TURBO_RATE 10 /*presses per second*/
+#define MAX_TURBO_RATE 50
+
+/*Output axis codes with this bit set press the output
+ *button in the rest of the code instead, once the axis
+ *passes AXIS_PRESS, until it drops back under AXIS_RELEASE.
+ *AXIS_NEG_BUTTON does the same in the negative direction.
+ *Either button can be 0 (KEY_RESERVED) for none.
+ */
+#define WG_AXIS_BUTTON 0x2000
+/*Output button codes with this bit set push the output
+ *axis in the rest of the code to the button's
+ *button_value while held.
+ */
+#define WG_BUTTON_AXIS 0x4000
+#define MAX_OUTPUT_KEY 0x300 /*KEY_CNT*/
+#define AXIS_PRESS_DEFAULT 50 /*percent*/
+#define AXIS_HYSTERESIS 10 /*percent below the press point to release*/
+
+/*Each input axis maps through a row of these.*/
+enum axis_entries {
+  AXIS_CODE,
+  AXIS_SCALE,
+  AXIS_CURVE, /*response curve, 0 for none. See response.c*/
+  AXIS_PRESS, /*for WG_AXIS_BUTTON, the output value that presses...*/
+  AXIS_RELEASE, /*...and the value it has to drop under to release*/
+  AXIS_NEG_BUTTON, /*for WG_AXIS_BUTTON, the button for the other direction*/
+  AXIS_FIELDS
+};
+
+
 /* Set a limit on file loading to avoid an endless loop.
  * With only so many settings to change, plus a modest
  * amount of comments, this should be sufficient.
@@ -30,78 +102,283 @@
 
 
 
+/*Everything here fits in 16 bits: output codes and their
+ *flags stay under 0x8000, and scales, curves, percents,
+ *and axis values are all within +/-ABS_LIMIT. Keeping it
+ *small keeps a device's whole map in a few cache lines.
+ */
 struct event_map {
-  int button_map[XWII_KEY_NUM];
-  //int waggle_button;
-  //int nunchuk_waggle_button;
-  //int waggle_cooldown;
-  int accel_active;
-  int accel_map[6][2];
-  int stick_map[6][2];
-  int balance_map[6][2];
-  //int balance_cog;
-  int IR_count;
-  //int IR_deadzone;
-  int IR_map[2][2];
+  int16_t button_map[XWII_KEY_NUM];
+  /*Presses per second while held, 0 for a plain button.
+   *For a macro, any nonzero value loops it while held.
+   */
+  int16_t button_turbo[XWII_KEY_NUM];
+  int16_t button_value[XWII_KEY_NUM]; /*for WG_BUTTON_AXIS, the axis value when held*/
+  int16_t waggle_button; /*output button for shaking the wiimote*/
+  int16_t nunchuk_waggle_button; /*and for shaking the nunchuk*/
+  int16_t waggle_threshold; /*average deviation from 1g to start a shake*/
+  int16_t waggle_cooldown; /*ms after a shake before the next*/
+  int16_t accel_active;
+  int16_t IR_count;
+  int16_t IR_predict; /*lead the two-dot pointer to hide camera lag*/
+  int16_t gyro_active; /*1 for gyro rates, 2 to also fuse an orientation*/
+  int16_t accel_map[6][AXIS_FIELDS];
+  int16_t stick_map[8][AXIS_FIELDS];
+  int16_t balance_map[7][AXIS_FIELDS];
+  int16_t IR_map[4][AXIS_FIELDS];
+  int16_t gyro_map[6][AXIS_FIELDS];
+};
+
+#define MAX_LAYERS 4
+
+/*An alternate set of mappings, used while its
+ *shift button is held. See control_mappings.c
+ */
+struct map_layer {
+  char name[WG_MAX_NAME_SIZE]; /*empty if unused*/
+  int shift; /*the wiimote button that selects it*/
+  struct event_map mode_no_ext;
+  struct event_map mode_nunchuk;
+  struct event_map mode_classic;
+};
+
+/*What a mapping actually maps. Copying a mapping just
+ *shares this, until one of them is edited.
+ *See control_mappings.c
+ */
+struct mapping_data {
+  int refs;
+  struct event_map mode_no_ext;
+  struct event_map mode_nunchuk;
+  struct event_map mode_classic;
+  struct map_layer layers[MAX_LAYERS];
 };
 
 struct mode_mappings {
-  char* name;
+  char name[WG_MAX_NAME_SIZE];
   int reference_count;
   /*I want devices to be able to share
    *mappings, but I also want to be
    *able to free up unused ones.
    */
-  struct event_map mode_no_ext;
-  struct event_map mode_nunchuk;
-  struct event_map mode_classic;
+  struct mapping_data *data;
+
+  /*A mapping can inherit whatever it doesn't map itself
+   *from a parent. data then holds the flattened result,
+   *and own marks the entries set on this mapping.
+   */
+  struct mode_mappings *parent;
+  uint64_t *own;
+  unsigned int flat_gen;
+
+  /*The slots and devices that picked this mapping, so
+   *a change only has to update their devices.
+   */
+  struct virtual_controller *slot_users;
+  struct wii_device *dev_users;
+
+  /*While a command file is loading, edits go
+   *to this private copy instead. It replaces
+   *this mapping once the whole file is read.
+   */
+  struct mode_mappings* pending;
 };
 
 struct virtual_controller;
 struct wii_device_list;
 
+/*Per-device, per-axis state of the one-euro
+ *smoothing filter. See response.c
+ */
+struct euro_state {
+  float value; /*filtered, as a fraction of full deflection*/
+  float speed; /*filtered, in full deflections per second*/
+  struct timeval last;
+  int primed;
+};
+
+/*Per-board tare and weight averaging.
+ *See balance.c
+ */
+#define BALANCE_WINDOW 16 /*readings, a power of two*/
+struct balance_filter {
+  int tare[4]; /*offsets, in WG_BAL_* order*/
+  int has_tare;
+  int history[BALANCE_WINDOW][4];
+  int sum[4];
+  int pos;
+  int count;
+};
+
+/*Per-device state for spotting a shake.
+ *See waggle.c
+ */
+#define WAGGLE_WINDOW 8 /*samples, a power of two*/
+#define WAGGLE_THRESHOLD 50
+#define WAGGLE_COOLDOWN 150
+struct waggle_detector {
+  int history[WAGGLE_WINDOW]; /*each sample's deviation from 1g*/
+  int sum;
+  int pos;
+  int active;
+  int code; /*what was pressed, to release the same thing*/
+  struct timeval last; /*when the last shake ended*/
+};
+
+/*Per-device state for following the two
+ *sensor bar dots. See ir_tracking.c
+ */
+struct ir_tracker {
+  int have_pair; /*has the separation below been seen?*/
+  int sep_x, sep_y; /*from the left dot to the right, camera pixels*/
+  int mid_x, mid_y; /*last midpoint, camera pixels*/
+  int accel_sign; /*which way the accelerometer's roll turns the camera*/
+
+  int have_pos;
+  int pos_x, pos_y; /*roll compensated pointer, 1/16 pixels*/
+  int vel_x, vel_y; /*1/16 pixels per second*/
+  struct timeval last;
+
+  /*results*/
+  int out_x, out_y; /*1/16 pixels from the center*/
+  int dist; /*dot separation in pixels*/
+  int roll; /*sine of the roll, out of 1024*/
+};
+
+/*Per-device state for combining Motion Plus
+ *and accelerometer readings. See motionplus.c
+ */
+struct motion_fusion {
+  float pitch, roll, yaw; /*degrees*/
+  float rate[3]; /*degrees/second, bias removed*/
+  float bias[3]; /*raw units*/
+  float pending; /*seconds not yet integrated*/
+  int accel[3];
+  int have_accel;
+  struct timeval last;
+};
+struct watched_file;
+struct wiimoteglue_state;
+struct timer_wheel;
+
+/*A timer on the timer wheel. See timers.c*/
+struct wg_timer {
+  struct wg_timer *prev, *next;
+  struct timer_wheel *wheel; /*NULL unless pending*/
+  uint64_t expires; /*CLOCK_MONOTONIC nanoseconds*/
+  void (*fire)(struct wiimoteglue_state *state, struct wg_timer *timer);
+  void *data;
+};
+
+#define WHEEL_BITS 8
+#define WHEEL_SIZE (1 << WHEEL_BITS) /*1ms buckets*/
+#define WHEEL_OUTER_BITS 6
+#define WHEEL_OUTER_SIZE (1 << WHEEL_OUTER_BITS) /*WHEEL_SIZE ms buckets*/
+
+struct timer_wheel {
+  struct wiimoteglue_state *state;
+  int fd;
+  uint64_t tick; /*every bucket up to this one has fired*/
+  uint64_t armed; /*tick the timerfd is set for, 0 for none*/
+  uint64_t now; /*nanoseconds, for timers as they fire*/
+  int count; /*pending timers*/
+  int running;
+  struct wg_timer inner[WHEEL_SIZE];
+  struct wg_timer outer[WHEEL_OUTER_SIZE];
+  uint64_t inner_used[WHEEL_SIZE/64]; /*buckets that may be non-empty*/
+  uint64_t outer_used;
+
+  /*How late timers fire, for "list timers".*/
+  unsigned long fired;
+  uint64_t late_total, late_max; /*nanoseconds*/
+};
+
+/*A turbo button or macro being played back
+ *for one of a device's buttons.
+ */
+struct button_player {
+  struct wg_timer timer;
+  struct wii_device *dev;
+  int code; /*output key, or WG_MACRO | macro number*/
+  int rate; /*the button's button_turbo setting*/
+  int step; /*next macro step*/
+  int held; /*is the input button still down?*/
+  int down; /*is the turbo output key currently pressed?*/
+};
+
+/*Mmm... Linked lists.
+ *Ease of insertion and deletion is nice.
+ *Users are unlikely to use more than a handful
+ *of controllers at once, and all lookups/iterations
+ *over this list are done in non-time-critical
+ *situations. The nodes live inside the devices.
+ */
+struct wii_device_list {
+  struct wii_device_list *prev, *next;
+
+  struct wii_device *dev;
+};
+
+#define BT_ADDR_SIZE 18
+
 struct wii_device {
 
+  /*Everything looked at for every event,
+   *kept together at the front.
+   */
   struct xwii_iface *xwii;
   struct virtual_controller *slot;
+  struct event_map *map;
   int fd;
-
   int ifaces;
-  struct event_map *map;
+  int layer; /*active layer+1, 0 for the base map*/
+  int merge_index; /*this device's bit in its slot's merge, or -1*/
+  enum DEVICE_TYPE { REMOTE, BALANCE, PRO, UNKNOWN} type;
+  enum MODE_TYPE { NO_EXT, NUNCHUK, CLASSIC} mode;
+
+  /*The current mode's base map and layers. Holding a
+   *shift button just points map at one of the layers.
+   */
+  struct event_map *base_map;
+  struct event_map *layer_maps[MAX_LAYERS];
+  signed char shift_layer[XWII_KEY_NUM]; /*layer+1 a button selects, or 0*/
+
+  /*What each held button pressed, so it is released
+   *properly even if the mapping changed meanwhile.
+   */
+  char key_down[XWII_KEY_NUM];
+  int key_output[XWII_KEY_NUM];
   struct mode_mappings* dev_specific_mappings;
+  struct wii_device *next_map_user; /*among that mapping's dev_users*/
 
-  char* id;
-  char* bluetooth_addr;
-  
-  struct udev_device* udev;
+  char id[WG_MAX_NAME_SIZE];
+  char bluetooth_addr[BT_ADDR_SIZE];
+  int index; /*in the device table, for as long as it is known*/
+  int in_use;
 
-  enum DEVICE_TYPE { REMOTE, BALANCE, PRO, UNKNOWN} type;
-  
-  enum MODE_TYPE { NO_EXT, NUNCHUK, CLASSIC} mode;
+  struct udev_device* udev;
 
   /*At any time, a device should be in at most
    *two lists: the main list of all devices,
    *and the list of devices for a certain slot.
    */
   struct wii_device_list *main_list, *slot_list;
+  struct wii_device_list main_node, slot_node;
 
   bool original_leds[4];
   /*Let's be nice and leave the LEDs
    *how we found them.
    */
-};
-
-/*Mmm... Linked lists.
- *Ease of insertion and deletion is nice.
- *Users are unlikely to use more than a handful
- *of controllers at once, and all lookups/iterations
- *over this list are done in non-time-critical
- *situations.
- */
-struct wii_device_list {
-  struct wii_device_list *prev, *next;
 
-  struct wii_device *dev;
+  struct motion_fusion fusion;
+  struct ir_tracker ir;
+  struct euro_state smooth_accel[6];
+  struct euro_state smooth_IR[2];
+  struct waggle_detector waggle[2]; /*wiimote, nunchuk*/
+  struct balance_filter balance;
+  unsigned char axis_keys[MAX_OUTPUT_KEY/8]; /*buttons held down by axes*/
+  struct button_player players[XWII_KEY_NUM];
+  struct wg_timer extension_timer; /*extension changes settling*/
 };
 
 struct map_list {
@@ -110,44 +387,210 @@ struct map_list {
   struct mode_mappings maps;
 };
 
+/*Remembered settings for a device, by bluetooth address.
+ *See registry.c
+ */
+#define REGISTRY_BUCKETS 64
+struct registry_entry {
+  struct registry_entry *next;
+  char bluetooth_addr[BT_ADDR_SIZE];
+  char id[WG_MAX_NAME_SIZE];
+  char slot_name[WG_MAX_NAME_SIZE];
+  char mapping_name[WG_MAX_NAME_SIZE];
+  int has_tare; /*balance boards only*/
+  int tare[4];
+};
+
+enum rel_output {
+  WG_REL_X,
+  WG_REL_Y,
+  WG_REL_WHEEL,
+  WG_REL_HWHEEL,
+  WG_REL_NUM,
+};
+
+/*How a relative axis turns a deflection into a speed.*/
+struct rel_curve {
+  int speed; /*counts/second at full deflection*/
+  int deadzone; /*out of ABS_LIMIT*/
+  float exponent;
+};
+
+/*Combining the output of every device in a slot.
+ *See merge.c
+ */
+#define MAX_SLOT_DEVICES 32 /*bits in a uint32_t*/
+#define MAX_OUTPUT_ABS 0x40 /*ABS_CNT*/
+#define MERGE_FRAME_SIZE 64
+enum merge_policy {MERGE_MAX, MERGE_LAST, MERGE_SUM};
+struct output_merge {
+  enum merge_policy policy; /*for axes; buttons are always held by any*/
+  uint32_t members; /*which device bits are taken*/
+  uint32_t key_holders[MAX_OUTPUT_KEY];
+  uint32_t abs_writers[MAX_OUTPUT_ABS]; /*devices with an axis off center*/
+  int abs_values[MAX_OUTPUT_ABS][MAX_SLOT_DEVICES];
+  int abs_out[MAX_OUTPUT_ABS]; /*what was last sent*/
+  uint32_t rel_writers[WG_REL_NUM]; /*same, for mouse velocities*/
+  int rel_values[WG_REL_NUM][MAX_SLOT_DEVICES];
+  struct input_event frame[MERGE_FRAME_SIZE];
+  int frame_len;
+};
+
 struct virtual_controller {
   int uinput_fd;
   int keyboardmouse_fd;
   int gamepad_fd;
+  int mouse_fd; /*shared by every slot*/
   int slot_number;
   char* slot_name;
   int has_wiimote;
   int has_board;
   enum SLOT_TYPE {SLOT_KEYBOARDMOUSE,SLOT_GAMEPAD} type;
   struct mode_mappings* slot_specific_mappings;
+  struct virtual_controller *next_map_user; /*among that mapping's slot_users*/
 
   struct wii_device_list dev_list;
+
+  /*Relative mouse motion, advanced by the mouse timer.
+   *Remainders are in 1/65536ths of a count, so slow
+   *motion still adds up to whole counts.
+   */
+  int rel_velocity[WG_REL_NUM]; /*combined from its devices, see merge.c*/
+  int rel_remainder[WG_REL_NUM];
+  int wheel_remainder[2]; /*hi-res wheel units not yet a whole detent*/
+  int rel_moving;
+
+  struct output_merge merge;
+};
+
+
+/*Which slots have room for another remote or board,
+ *and how to pick one. See slot_management.c
+ */
+#define MAX_SLOTS 128
+#define SLOT_WORDS (MAX_SLOTS/64 + 1) /*bit n for slot n; slot 0 is never free*/
+enum slot_policy {SLOT_STICKY, SLOT_LOWEST, SLOT_ROUND_ROBIN};
+struct slot_allocator {
+  uint64_t free_remote[SLOT_WORDS];
+  uint64_t free_board[SLOT_WORDS];
+  int policy;
+  int next; /*where round-robin looks first*/
 };
 
+/*How long input events take from the kernel to our
+ *uinput write, for "list latency". See realtime.c
+ */
+#define RT_DEFAULT_PRIORITY 20
+#define LATENCY_BUCKETS 8
+#define LATENCY_FIRST_BUCKET_US 125 /*each bucket after this is twice as wide*/
+struct latency_stats {
+  unsigned long count;
+  uint64_t total, max; /*microseconds*/
+  double total_sq;
+  unsigned long buckets[LATENCY_BUCKETS];
+};
+
+/*Spinning on epoll for a little while after each event
+ *instead of going right back to sleep, for --busy-poll.
+ *See epoll.c
+ */
+#define BUSY_POLL_DEFAULT_BUDGET 50
+struct busy_poll {
+  uint64_t window; /*nanoseconds to spin after an event, 0 to never spin*/
+  int budget; /*percent of each second that may be spent spinning*/
+  uint64_t last_event;
+  uint64_t period_start;
+  uint64_t spent; /*nanoseconds spun this second*/
+
+  /*For "list latency".*/
+  unsigned long wakeups;
+  unsigned long caught; /*wakeups that came while spinning*/
+  uint64_t spent_total;
+};
+
+/*Every device lives here, in chunks that are allocated
+ *as needed and never moved, so a device keeps its index
+ *and address for as long as it is known.
+ *See device_management.c
+ */
+#define DEVICE_CHUNK_SIZE 16
+#define MAX_DEVICE_CHUNKS 16
+#define MAX_DEVICES (DEVICE_CHUNK_SIZE * MAX_DEVICE_CHUNKS)
+struct device_table {
+  struct wii_device *chunks[MAX_DEVICE_CHUNKS];
+  uint64_t free_spots[MAX_DEVICES/64]; /*a bit for each allocated spot not in use*/
+  int size; /*devices in the allocated chunks*/
+  int count; /*devices in use*/
+};
+
+/*Fixed-size objects, recycled through a free list.
+ *See pool.c
+ */
+struct pool {
+  size_t size; /*of each object*/
+  int per_chunk;
+  void *free_list;
+  void *chunks;
+};
+#define POOL_INIT(type,count) { sizeof(type), (count), NULL, NULL }
 
 struct wiimoteglue_state {
   struct udev_monitor *monitor;
   struct virtual_controller* slots;
   int num_slots;
+  struct slot_allocator slot_alloc;
 
   int virtual_keyboardmouse_fd; /*Handy enough to keep around*/
 
   int epfd;
+  struct epoll_event *events; /*room for every watched fd; see epoll.c*/
+  int max_events;
+  int watched_fds;
   int keep_looping;
   int load_lines; /*how many lines of loaded files have we processed? */
   int dev_count; /*simple counter for making identifiers*/
   int ignore_pro; /*ignore Wii U Pro Controllers?*/
   int set_leds; /*Should we try changing controlle LEDs?*/
+  int staging; /*are mapping edits being held until a file finishes loading?*/
 
+  int inotify_fd; /*-1 if we aren't watching command files*/
+  struct watched_file *watched_files;
+
+  struct device_table devices;
   struct wii_device_list dev_list;
   struct map_list head_map;
+
+  char *registry_path; /*NULL if devices aren't being remembered*/
+  struct registry_entry *registry[REGISTRY_BUCKETS];
+
+  struct timer_wheel timers;
+
+  struct wg_timer mouse_tick; /*pending while the mouse is moving*/
+  int mouse_rate; /*ticks per second while the mouse is moving*/
+  struct rel_curve rel_curves[WG_REL_NUM];
+
+  int realtime_priority; /*SCHED_FIFO priority, 0 if not real-time*/
+  struct latency_stats event_latency;
+  struct busy_poll busy_poll;
 };
 
 int * KEEP_LOOPING; //Sprinkle around some checks to let signals interrupt.
 
-enum axis_entries {
-  AXIS_CODE,
-  AXIS_SCALE,
+#define MAX_CUSTOM_POINTS 17
+
+/*Describes a response curve. Axes with identical
+ *parameters share one curve, and curves with the same
+ *shape share one precomputed table.
+ */
+struct response_params {
+  float deadzone; /*these three are fractions of full deflection*/
+  float antideadzone;
+  float saturation;
+  float exponent;
+  int custom_count; /*if nonzero, custom points replace the exponent*/
+  float custom[MAX_CUSTOM_POINTS];
+  float smooth_cutoff; /*one-euro filter minimum cutoff in Hz, 0 for off*/
+  float smooth_beta; /*how quickly the cutoff rises with speed*/
 };
 
 enum accel_axis {
@@ -166,11 +609,24 @@ enum stick_axis {
   WG_RIGHT_Y,
   WG_N_X,
   WG_N_Y,
+  WG_L_TRIGGER,
+  WG_R_TRIGGER,
 };
 
 enum IR_axis {
   WG_IR_X,
   WG_IR_Y,
+  WG_IR_DIST,
+  WG_IR_ROLL,
+};
+
+enum gyro_axis {
+  WG_GYRO_X,
+  WG_GYRO_Y,
+  WG_GYRO_Z,
+  WG_PITCH,
+  WG_ROLL,
+  WG_YAW,
 };
 
 enum bal_axis {
@@ -179,38 +635,164 @@ enum bal_axis {
   WG_BAL_BL,
   WG_BAL_BR,
   WG_BAL_X,
-  WG_BAL_Y
+  WG_BAL_Y,
+  WG_BAL_WEIGHT
 };
 
 char* try_to_find_uinput();
 int wiimoteglue_uinput_close(int num_slots, struct virtual_controller slots[]);
 int wiimoteglue_uinput_init(int num_slots, struct virtual_controller slots[], char* uinput_path);
+int open_uinput_mouse_fd(char* uinput_path);
 
 int wiimoteglue_udev_monitor_init(struct udev **udev, struct udev_monitor **monitor, int *mon_fd);
 int wiimoteglue_udev_handle_event(struct wiimoteglue_state* state);
 
-int wiimoteglue_epoll_init(int *epfd);
-int wiimoteglue_epoll_watch_monitor(int epfd, int mon_fd, void *monitor);
-int wiimoteglue_epoll_watch_wiimote(int epfd, struct wii_device *device);
+int wiimoteglue_epoll_init(struct wiimoteglue_state* state, int *epfd);
+int wiimoteglue_epoll_watch_monitor(struct wiimoteglue_state* state, int epfd, int mon_fd, void *monitor);
+int wiimoteglue_epoll_watch_wiimote(struct wiimoteglue_state* state, int epfd, struct wii_device *device);
+int wiimoteglue_epoll_unwatch_wiimote(struct wiimoteglue_state* state, int epfd, struct wii_device *device);
+void wiimoteglue_epoll_close(struct wiimoteglue_state* state, int epfd);
 int wiimoteglue_epoll_watch_stdin(struct wiimoteglue_state* state, int epfd);
+int wiimoteglue_epoll_watch_inotify(struct wiimoteglue_state* state, int epfd);
+int wiimoteglue_epoll_watch_timers(struct wiimoteglue_state* state, int epfd);
 void wiimoteglue_epoll_loop(int epfd, struct wiimoteglue_state *state);
 
+int wiimoteglue_inotify_init(int *inotify_fd);
+int wiimoteglue_inotify_watch_file(struct wiimoteglue_state *state, char *filename);
+int wiimoteglue_inotify_handle_event(struct wiimoteglue_state *state);
+int wiimoteglue_inotify_close(struct wiimoteglue_state *state);
+
+int wiimoteglue_timers_init(struct wiimoteglue_state *state);
+int wiimoteglue_timers_handle_tick(struct wiimoteglue_state *state);
+int wiimoteglue_timers_close(struct wiimoteglue_state *state);
+uint64_t timer_now();
+int timer_schedule(struct timer_wheel *wheel, struct wg_timer *timer, uint64_t expires);
+int timer_start(struct timer_wheel *wheel, struct wg_timer *timer, uint64_t delay);
+void timer_cancel(struct wg_timer *timer);
+int timer_pending(struct wg_timer *timer);
+
+int turbo_press(struct wiimoteglue_state *state, struct wii_device *dev, struct event_map *map, int button);
+int turbo_release(struct wii_device *dev, int button);
+void turbo_stop_device(struct wii_device *dev);
+int macro_define(char *name, char *steps[]);
+int macro_lookup(char *name);
+int list_macros();
+void macros_free();
+
+int wiimoteglue_realtime_init(struct wiimoteglue_state *state, int priority, char *cpus);
+int realtime_check_cpus(char *list);
+void latency_record(struct latency_stats *stats, struct timeval *time);
+
+int wiimoteglue_mouse_init(struct wiimoteglue_state *state);
+int wiimoteglue_mouse_close(struct wiimoteglue_state *state);
+void mouse_set_velocity(struct wii_device *dev, int rel_code, int value);
+void mouse_stop_slot(struct virtual_controller *slot);
+int mouse_update_timer(struct wiimoteglue_state *state);
+int mouse_set_rate(struct wiimoteglue_state *state, int rate);
+
+int wiimoteglue_registry_load(struct wiimoteglue_state *state, char *filename);
+int wiimoteglue_registry_save(struct wiimoteglue_state *state);
+int wiimoteglue_registry_close(struct wiimoteglue_state *state);
+struct registry_entry* registry_lookup(struct wiimoteglue_state *state, char *addr);
+int registry_id_in_use(struct wiimoteglue_state *state, char *id, char *addr);
+int registry_remember_device(struct wiimoteglue_state *state, struct wii_device *dev);
+int registry_forget_mapping(struct wiimoteglue_state *state, struct wii_device *dev);
+int registry_forget_slot(struct wiimoteglue_state *state, struct wii_device *dev);
+int registry_restore_mapping(struct wiimoteglue_state *state, struct mode_mappings *maps);
+int registry_restore_device(struct wiimoteglue_state *state, struct wii_device *dev);
+struct virtual_controller* registry_preferred_slot(struct wiimoteglue_state *state, struct wii_device *dev);
+
 int wiimoteglue_load_command_file(struct wiimoteglue_state *state, char *filename);
 int wiimoteglue_handle_input(struct wiimoteglue_state *state, int file);
 
 int wiimoteglue_update_wiimote_ifaces(struct wii_device *dev);
+int ir_track(struct ir_tracker *ir, struct xwii_event_abs *dots, struct motion_fusion *motion, struct timeval *time, int predict);
+void balance_reset(struct balance_filter *board);
+int balance_update(struct balance_filter *board, struct xwii_event_abs ev[], int corners[4]);
+int balance_tare(struct balance_filter *board);
+void balance_clear_tare(struct balance_filter *board);
+void waggle_reset(struct waggle_detector *waggle);
+void waggle_stop_device(struct wii_device *dev);
+void axis_keys_release(struct wii_device *dev);
+void slot_merge_key(struct wii_device *dev, int code, int value);
+void slot_merge_abs(struct wii_device *dev, int code, int value);
+int slot_merge_rel(struct wii_device *dev, int rel, int value);
+void slot_merge_flush(struct virtual_controller *slot);
+void slot_merge_join(struct virtual_controller *slot, struct wii_device *dev);
+void slot_merge_leave(struct wii_device *dev);
+void slot_merge_clear(struct virtual_controller *slot);
+char* merge_policy_name(int policy);
+int merge_policy_lookup(char *name);
+int waggle_update(struct waggle_detector *waggle, struct xwii_event_abs *accel, int threshold, int cooldown, struct timeval *time);
+void motionplus_reset(struct motion_fusion *fusion);
+void motionplus_accel(struct motion_fusion *fusion, struct xwii_event_abs *accel);
+void motionplus_rates(struct motion_fusion *fusion, struct xwii_event_abs *gyro);
+void motionplus_fuse(struct motion_fusion *fusion, struct timeval *time);
 int wiimoteglue_handle_wii_event(struct wiimoteglue_state *state, struct wii_device *dev);
+int wiimoteglue_update_extensions(struct wiimoteglue_state *state, struct wii_device *dev);
+void wiimoteglue_queue_extension_update(struct wiimoteglue_state *state, struct wii_device *dev);
+
+struct wii_device_list* new_wii_device(struct wiimoteglue_state *state, char* uniq);
+int add_wii_device(struct wiimoteglue_state *state, struct udev_device* udev);
+int open_wii_device(struct wiimoteglue_state *state, struct wii_device* dev);
+int close_wii_device(struct wiimoteglue_state* state, struct wii_device *dev);
+int auto_assign_slot(struct wiimoteglue_state* state, struct wii_device *dev);
+int store_led_state(struct wiimoteglue_state* state, struct wii_device *dev);
+int set_led_state(struct wiimoteglue_state* state, struct wii_device *dev, bool leds[]);
+int forget_wii_device(struct wiimoteglue_state* state, struct wii_device *dev);
+int set_device_specific_mappings(struct wii_device *dev, struct mode_mappings *maps);
+struct wii_device* device_table_get(struct wiimoteglue_state *state, int index);
+void* pool_alloc(struct pool *pool);
+void pool_free(struct pool *pool, void *object);
+void pool_destroy(struct pool *pool);
+void device_table_close(struct wiimoteglue_state *state);
 
 struct virtual_controller* find_open_slot(struct wiimoteglue_state *state, int dev_type);
+int slot_has_room(struct virtual_controller *slot, int dev_type);
+int add_device_to_slot(struct wiimoteglue_state* state, struct wii_device *dev, struct virtual_controller *slot);
+int remove_device_from_slot(struct wiimoteglue_state* state, struct wii_device *dev);
+int slot_allocator_init(struct wiimoteglue_state *state);
+int change_slot_type(struct wiimoteglue_state* state, struct virtual_controller *slot, enum SLOT_TYPE type);
+void slot_update_free(struct wiimoteglue_state *state, struct virtual_controller *slot);
+char* slot_policy_name(int policy);
+int slot_policy_lookup(char *name);
 struct virtual_controller* lookup_slot(struct wiimoteglue_state* state, char* name);
+struct wii_device* lookup_device(struct wii_device_list *devlist, char *name);
 
 int wiimoteglue_compute_all_device_maps(struct wiimoteglue_state* state, struct wii_device_list *devlist);
 int compute_device_map(struct wiimoteglue_state* state, struct wii_device *devlist);
+struct event_map* lookup_mode_map(struct mode_mappings *maps, char *mode);
+int layer_lookup(struct mode_mappings *maps, char *name);
+int layer_define(struct mode_mappings *maps, char *name, char *button);
 struct mode_mappings* lookup_mappings(struct wiimoteglue_state* state, char* map_name);
 struct map_list* create_mappings(struct wiimoteglue_state *state, char *name);
-
-int * get_input_key(char *key_name, int button_map[]);
-int * get_input_axis(char *axis_name, struct event_map *map);
+struct mode_mappings* mappings_for_edit(struct wiimoteglue_state *state, struct mode_mappings *maps);
+struct mode_mappings* mappings_for_write(struct wiimoteglue_state *state, struct mode_mappings *maps);
+int mappings_unshare(struct mode_mappings *maps);
+void mappings_ref(struct mode_mappings *maps);
+void mappings_unref(struct mode_mappings *maps);
+int copy_mappings(struct mode_mappings *dest, struct mode_mappings *src);
+void mappings_override(struct mode_mappings *maps, void *entry, size_t size);
+int mappings_set_parent(struct wiimoteglue_state *state, struct mode_mappings *maps, struct mode_mappings *parent);
+int mappings_changed(struct wiimoteglue_state *state, struct mode_mappings *maps);
+void mappings_add_slot_user(struct mode_mappings *maps, struct virtual_controller *slot);
+void mappings_remove_slot_user(struct mode_mappings *maps, struct virtual_controller *slot);
+void mappings_add_device_user(struct mode_mappings *maps, struct wii_device *dev);
+void mappings_remove_device_user(struct mode_mappings *maps, struct wii_device *dev);
+int publish_pending_mappings(struct wiimoteglue_state *state);
+void mappings_close(struct wiimoteglue_state *state);
+
+void response_default_params(struct response_params *params);
+int response_curve_get(struct response_params *params);
+void response_curve_ref(int curve);
+void response_curve_unref(int curve);
+struct response_params* response_curve_params(int curve);
+int response_apply(int curve, int value);
+int response_smooth(int curve, struct euro_state *filter, int value, struct timeval *time);
+void response_curves_free();
+
+int16_t * get_input_key(char *key_name, int16_t button_map[]);
+int16_t * get_input_axis(char *axis_name, struct event_map *map);
 int get_output_key(char *key_name);
 int get_output_axis(char *axis_name);
 